@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/**
+ * Appends timestamped lines to a log file without blocking the caller on I/O. log() formats
+ * the record and pushes it onto a bounded lock-free ring; a writer thread drains the ring and
+ * writes everything it finds with a single write(). When the ring is full the record is
+ * dropped and counted, and the writer notes how many were lost once it catches up.
+ *
+ * Lines use the same layout as a Database<2, '\t'>: the time, a tab and the escaped message.
+ *
+ * With a Rotation, the file is a series of segments. Once the current one reaches maxSize bytes
+ * or maxAge seconds, the writer renames it to `<file>.<YYYYmmdd-HHMMSS>` and starts a new one.
+ * A maintenance thread then gzips the closed segment (when built with zlib) and deletes the
+ * oldest ones beyond `keep`.
+ */
+class AsyncLogger {
+	public:
+	static constexpr size_t CAPACITY = 4096; // Records; must be a power of two
+	static constexpr size_t MAX_WRITE = 64u * 1024u;
+	
+	struct Rotation {
+		size_t maxSize;   // Bytes per segment, or 0 for no limit
+		time_t maxAge;    // Seconds per segment, or 0 for no limit
+		size_t keep;      // Closed segments to keep, or 0 to keep them all
+	};
+	
+	private:
+	struct Slot {
+		std::atomic<size_t> sequence{0};
+		std::string record{};
+	};
+	
+	std::unique_ptr<Slot[]> slots;
+	alignas(64) std::atomic<size_t> enqueuePosition{0};
+	alignas(64) size_t dequeuePosition = 0; // Only touched by the writer
+	std::atomic<size_t> droppedRecords{0};
+	size_t reportedDrops = 0;
+	
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	std::atomic<bool> writerWaiting{false};
+	std::atomic<bool> stopping{false};
+	const std::string filename;
+	const Rotation rotation;
+	int fd = -1;
+	size_t segmentSize = 0;
+	time_t segmentStart = 0;
+	std::thread maintenance{}; // Compresses and prunes closed segments
+	std::thread writer;
+	
+	public:
+	explicit AsyncLogger(std::string filename, Rotation rotation = {});
+	AsyncLogger(const AsyncLogger &) = delete;
+	AsyncLogger& operator=(const AsyncLogger &) = delete;
+	~AsyncLogger(); // Writes out everything already logged
+	
+	/// Safe to call from any thread. Returns false if the record was dropped.
+	bool log(std::string_view message);
+	[[nodiscard]] inline size_t dropped() const noexcept { return droppedRecords.load(std::memory_order_relaxed); }
+	
+	private:
+	bool push(std::string && record);
+	bool pop(std::string & batch);
+	void drain();
+	void writeBatch(const std::string & batch);
+	void openSegment();
+	void rollSegment();
+	static void compressSegment(const std::string & segment);
+	static void pruneSegments(const std::string & filename, size_t keep);
+	/// Formats `now` once per second per thread
+	static std::string_view timestamp(time_t now);
+};
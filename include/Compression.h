@@ -0,0 +1,72 @@
+#pragma once
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <NetworkMessage.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Payload compression for frames sent with FrameHeader::COMPRESSED set. A compressed payload is
+ * the codec (u8), the uncompressed length as a varint, then the codec's output. The built-in LZ
+ * codec is always available; zlib is used too when the build found it.
+ */
+struct Compression {
+	enum class Codec : uint8_t {
+		LZ   = 0,
+		ZLIB = 1,
+		COUNT
+	};
+	
+	/// Payloads shorter than this are never worth compressing
+	static constexpr size_t THRESHOLD = 256;
+	/// Refuse to inflate beyond this, so a tiny frame can't claim an enormous output
+	static constexpr size_t MAX_DECOMPRESSED = FrameHeader::MAX_EXTENDED_PAYLOAD;
+	/// Output is reserved for at most this many times the compressed size up front, however long
+	/// the sender claims it is, and grows as it is actually produced
+	static constexpr size_t RESERVE_RATIO = 4;
+
+#ifdef HAVE_ZLIB
+	static constexpr uint32_t CAPABILITIES = Capability::COMPRESSION | Capability::COMPRESSION_ZLIB;
+#else
+	static constexpr uint32_t CAPABILITIES = Capability::COMPRESSION;
+#endif
+	
+	/// The best codec both peers agreed to, if any
+	static std::optional<Codec> codecFor(uint32_t capabilities) noexcept;
+	
+	/// Returns the compressed payload, or nothing if it is below THRESHOLD or wouldn't shrink
+	static std::optional<std::vector<BufferByte>> compress(Codec codec, std::string_view input);
+	/// Returns false if the payload is corrupt, uses an unknown codec or is too large
+	static bool decompress(const BufferByte * payload, size_t length, std::string & output);
+	
+	private:
+	static void compressLZ(const uint8_t * input, size_t length, std::vector<BufferByte> & output);
+	static bool decompressLZ(const uint8_t * input, size_t length, size_t limit, std::string & output);
+#ifdef HAVE_ZLIB
+	static bool compressZlib(const uint8_t * input, size_t length, std::vector<BufferByte> & output);
+	static bool decompressZlib(const uint8_t * input, size_t length, size_t limit, std::string & output);
+#endif
+};
+
+/**
+ * A frame whose payload was compressed up front. Compressing costs far more than sending, so
+ * build these once and reuse them, e.g. through a ResponseCache.
+ */
+class CompressedMessage : public EncodableMessage<CompressedMessage> {
+	MessageType type;
+	std::vector<BufferByte> payload;
+	
+	public:
+	CompressedMessage(MessageType type, std::vector<BufferByte> payload) : type(type), payload(std::move(payload)) {}
+	
+	[[nodiscard]] inline size_t encodedSize() const noexcept { return FrameHeader::frameLength(payload.size()); }
+	using EncodableMessage::encodeInto;
+	size_t encodeInto(BufferByte * dst, size_t capacity) const noexcept;
+};
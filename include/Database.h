@@ -1,28 +1,122 @@
 #pragma once
 
 #include <functional>
+#include <iterator>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <optional>
 #include <utility>
+#include <memory>
+#include <mutex>
 #include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
 #include <climits>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/file.h>
 #include <sys/stat.h>
 
+/// A read-only mapping of a whole file. Empty and unreadable files map to an empty range.
+class MappedFile {
+	int fd = -1;
+	const char * data = nullptr;
+	size_t length = 0;
+	
+	public:
+	explicit MappedFile(const std::string & filename);
+	MappedFile(const MappedFile &) = delete;
+	MappedFile& operator=(const MappedFile &) = delete;
+	~MappedFile();
+	
+	[[nodiscard]] inline bool valid() const noexcept { return fd >= 0; }
+	[[nodiscard]] inline const char * begin() const noexcept { return data; }
+	[[nodiscard]] inline const char * end() const noexcept { return data + length; }
+};
+
+struct DatabaseScan {
+	/// The first delimiter, backslash, '\r' or '\n' in [p, end), or end. Uses AVX2 or SSE2 when
+	/// the CPU has them.
+	static const char * findSpecial(const char * p, const char * end, char delimiter) noexcept;
+	
+	/// Whether c ends a row. Both '\r' and '\n' do, so "\r\n" is a row followed by an empty line.
+	static constexpr bool isLineEnd(char c) noexcept { return c == '\n' || c == '\r'; }
+	
+	/// The first line end in [p, end), or end
+	static const char * findLineEnd(const char * p, const char * end) noexcept {
+		auto lineEnd = static_cast<const char *>(memchr(p, '\n', end - p));
+		if (lineEnd == nullptr)
+			lineEnd = end;
+		const auto cr = static_cast<const char *>(memchr(p, '\r', lineEnd - p));
+		return cr != nullptr ? cr : lineEnd;
+	}
+	
+	/// The start of the row after the line end (or end) at p
+	static const char * nextLine(const char * p, const char * end) noexcept { return p < end ? p + 1 : end; }
+};
+
+/**
+ * Formats rows into a large buffer and writes it out once FLUSH_SIZE has built up, so a rewrite
+ * takes a handful of syscalls rather than several per row. Columns are escaped the way
+ * Database::scan reads them; line breaks can't be escaped, so they are written as spaces.
+ */
+class RowWriter {
+	int fd;
+	char delimiter;
+	std::string buffer{};
+	bool failed = false;
+	
+	public:
+	static constexpr size_t FLUSH_SIZE = 256u * 1024u;
+	
+	RowWriter(int fd, char delimiter) : fd(fd), delimiter(delimiter) { buffer.reserve(FLUSH_SIZE); }
+	
+	template<typename Row>
+	void writeRow(const Row & row) {
+		for (size_t i = 0; i < row.size(); i++) {
+			if (i > 0)
+				buffer += delimiter;
+			appendEscaped(buffer, row[i], delimiter);
+		}
+		buffer += '\n';
+		if (buffer.length() >= FLUSH_SIZE)
+			flush();
+	}
+	
+	inline void endLine() { buffer += '\n'; }
+	
+	/// Writes out what is buffered. Returns false if this or any earlier write failed.
+	bool flush();
+	
+	static void appendEscaped(std::string & out, std::string_view column, char delimiter);
+};
+
 template<int columns, char delimeter = ','>
 class Database {
+	protected:
+	static constexpr mode_t APPENDABLE_MODE = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
 	const std::string filename;
+	const bool durable;   // Writes are on disk before they return, not just handed to the kernel
 	
 	public:
-	explicit Database(std::string filename) : filename(std::move(filename)) {}
+	/// A durable Database flushes every write to disk before returning, so it survives a power
+	/// cut and not only the process crashing, at the cost of a disk round trip per write
+	explicit Database(std::string filename, bool durable = false) : filename(std::move(filename)), durable(durable) {}
 	~Database() = default;
 	
 	using DatabaseRow = std::array<std::string, columns>;
 	using FindDatabaseRowFunction = const std::function<bool(const DatabaseRow &)> &;
 	using ReadDatabaseRowFunction = const std::function<bool(const DatabaseRow &)> &;
 	using UpdateDatabaseRowFunction = const std::function<DatabaseRow(const DatabaseRow &)> &;
+	using DatabaseRowView = std::array<std::string_view, columns>;
+	using ScanDatabaseRowFunction = const std::function<bool(const DatabaseRowView &)> &;
 	
 	std::optional<DatabaseRow> find(FindDatabaseRowFunction op) {
 		std::optional<DatabaseRow> ret = std::nullopt;
@@ -37,113 +131,714 @@ class Database {
 	}
 	
 	bool update(UpdateDatabaseRowFunction op) {
-		return updateFile([&](int fd) {
-			return readFromFile([&](const DatabaseRow & row) {
-				writeToFile(fd, op(row));
+		bool written = false;
+		do {
+			const auto info = statFile();
+			written = updateFile([&](RowWriter & writer) {
+				return readFromFile([&](const DatabaseRow & row) {
+					writer.writeRow(op(row));
+					return true;
+				}) == 0;
+			}, APPENDABLE_MODE, &info);
+		} while (!written && errno == ESTALE); // Appended to while it was read
+		return written;
+	}
+	
+	/// Appends one row with a single write, so the cost doesn't depend on the size of the file.
+	/// Files left read-only by an older rewrite are rewritten once, as appendable.
+	/// `before` and `after`, if given, are set to the file just before and after the append, both
+	/// taken under the lock, so a caller that had read `before` knows the file is now that plus
+	/// `data`. A rewrite leaves them zeroed.
+	bool insert(const DatabaseRow & data, struct stat * before = nullptr, struct stat * after = nullptr) {
+		if (before != nullptr)
+			*before = {};
+		if (after != nullptr)
+			*after = {};
+		
+		int fd = openLocked(O_RDWR | O_APPEND | O_CREAT);
+		if (fd < 0) {
+			if (errno != EACCES)
+				return false;
+			return updateFile([&](RowWriter & writer) {
+				readFromFile([&](const DatabaseRow & row) { writer.writeRow(row); return true; });
+				writer.writeRow(data);
 				return true;
-			}) == 0;
-		});
+			});
+		}
+		
+		// Don't run into a last row that was written without its newline
+		RowWriter writer(fd, delimeter);
+		struct stat info{};
+		char last = '\n';
+		if (fstat(fd, &info) == 0 && info.st_size > 0 && pread(fd, &last, 1, info.st_size - 1) == 1 && last != '\n')
+			writer.endLine();
+		writer.writeRow(data);
+		auto written = writer.flush();
+		// A file that was empty may have just been created, so its directory entry is flushed too
+		if (written && durable)
+			written = fdatasync(fd) == 0 && (info.st_size > 0 || syncDirectory());
+		if (written && before != nullptr && after != nullptr && fstat(fd, after) == 0)
+			*before = info;
+		close(fd);
+		return written;
 	}
 	
-	bool insert(const DatabaseRow & data) {
-		return updateFile([&](int fd) {
-			readFromFile([&](const DatabaseRow & row) { writeToFile(fd, row); return true; });
-			writeToFile(fd, data);
-			return true;
-		});
+	/// Adds rows with a single rewrite of the file, which replaces it atomically, so readers see
+	/// all of them or none. For adding many rows at once.
+	bool insert(const std::vector<DatabaseRow> & rows) {
+		bool written = false;
+		do {
+			const auto info = statFile();
+			written = updateFile([&](RowWriter & writer) {
+				// Don't rewrite a file that exists but can't be read as an empty one
+				if (readFromFile([&](const DatabaseRow & row) { writer.writeRow(row); return true; }) != 0
+						&& access(filename.c_str(), F_OK) == 0)
+					return false;
+				for (const auto & row : rows)
+					writer.writeRow(row);
+				return true;
+			}, APPENDABLE_MODE, &info);
+		} while (!written && errno == ESTALE);
+		return written;
 	}
 	
-	private:
-	int readFromFile(ReadDatabaseRowFunction op) {
-		std::array<char, 1024> buffer{};
-		DatabaseRow data{};
-		std::vector<char> stringBuffer;
-		int currentColumn = 0;
-		bool escaped = false;
-		
-		int fd = open(filename.c_str(), 0, O_RDONLY);
-		if (fd < 0)
+	/**
+	 * Calls op for each row until it returns false, with columns pointing into the mapped file
+	 * (or into scratch space for a row with escapes). The views only last for the call.
+	 * Returns -1 if the file can't be read.
+	 *
+	 * Rows end at '\r' or '\n' and empty lines are skipped. A backslash escapes the next
+	 * character, so "\\" is a backslash and "\," a delimiter within a column. Rows without
+	 * the right number of columns are skipped.
+	 */
+	int scan(ScanDatabaseRowFunction op) const {
+		MappedFile file(filename);
+		if (!file.valid())
 			return -1;
 		
-		bool terminateRead = false;
-		int n;
-		while (!terminateRead && (n = read(fd, buffer.data(), buffer.size())) > 0) {
-			for (int i = 0; i < n; i++) {
-				switch (buffer[i]) {
-					case '\\':
-						if (escaped)
-							stringBuffer.push_back('\\');
-						escaped = !escaped;
-						break;
-					case delimeter:
-						if (!escaped) {
-							data[currentColumn] = std::string(&stringBuffer[0], stringBuffer.size());
-							currentColumn++;
-							stringBuffer.clear();
-							break;
-						}
-					default:
-						stringBuffer.push_back(buffer[i]);
-						escaped = false;
-						break;
-					case '\r':
-					case '\n':
-						if (currentColumn+1 != columns) {
-							currentColumn = 0;
-							escaped = false;
-							stringBuffer.clear();
-							break;
-						}
-						data[currentColumn] = std::string(&stringBuffer[0], stringBuffer.size());
-						if (!op(data))
-							terminateRead = true;
-						stringBuffer.clear();
-						currentColumn = 0;
-						escaped = false; // We don't escape newlines
-						break;
+		DatabaseRowView row{};
+		std::string scratch{};
+		const auto end = file.end();
+		for (auto p = file.begin(); p < end; ) {
+			const auto line = p;
+			auto field = p;
+			int column = 0;
+			while (true) {
+				p = DatabaseScan::findSpecial(p, end, delimeter);
+				if (p < end && *p == '\\') {
+					p = scanEscaped(line, end, row, scratch, column);
+					break;
 				}
+				if (column < columns)
+					row[column] = std::string_view(field, p - field);
+				column++;
+				if (p == end || *p != delimeter)
+					break;
+				field = ++p;
 			}
+			
+			const bool empty = p == line;
+			p = DatabaseScan::nextLine(p, end);
+			if (!empty && column == columns && !op(row))
+				break;
 		}
-		if (currentColumn+1 == columns) {
-			data[currentColumn] = std::string(&stringBuffer[0], stringBuffer.size());
-			op(data);
-		}
-		close(fd);
 		return 0;
 	}
 	
-	bool updateFile(const std::function<bool(int fd)> & op) {
-		auto tmpfile = filename + ".tmp";
-		remove(tmpfile.c_str());
-		int fd = open(tmpfile.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IWUSR);
-		if (!op(fd)) {
+	/**
+	 * One row of Rows. A column is only split out of the line when it, or a later one, is first
+	 * read, so reading the first column of a row never looks at the rest. Unescaping is the same
+	 * as scan(), but rows aren't checked for their number of columns: missing columns read as
+	 * empty and extra ones are ignored. Views last until the Rows moves on to the next row.
+	 */
+	class Row {
+		mutable const char * next = nullptr;  // Start of column `split`, or null after the last
+		const char * end = nullptr;           // End of the line
+		mutable std::array<std::string_view, columns> parsed{};
+		mutable int split = 0;                // Columns in `parsed`
+		std::string * scratch = nullptr;      // For lines with escapes
+		
+		public:
+		Row() = default;
+		Row(const char * line, const char * end, std::string * scratch) : next(line), end(end), scratch(scratch) {}
+		
+		std::string_view operator[](int column) const {
+			while (split <= column) {
+				if (next == nullptr) {
+					parsed[split++] = {};
+					continue;
+				}
+				const auto p = DatabaseScan::findSpecial(next, end, delimeter);
+				if (p < end && *p == '\\') {
+					// Unescape the whole line once, from the start of the first column
+					int count = 0;
+					scanEscaped(split == 0 ? next : parsed[0].data(), end, parsed, *scratch, count);
+					next = nullptr;
+					split = columns;
+					break;
+				}
+				parsed[split++] = std::string_view(next, p - next);
+				next = p < end && *p == delimeter ? p + 1 : nullptr;
+			}
+			return parsed[column];
+		}
+		
+		[[nodiscard]] DatabaseRowView view() const {
+			operator[](columns - 1);
+			return parsed;
+		}
+	};
+	
+	/**
+	 * The rows of the file, for iterating over with early exit and no per-row callback:
+	 *
+	 *   for (const auto & row : db.scan())
+	 *       if (row[0] == name) ...
+	 *
+	 * The file is mapped for as long as the Rows lives. Empty and unreadable files have no rows.
+	 */
+	class Rows {
+		MappedFile file;
+		std::string scratch{};
+		
+		public:
+		class iterator {
+			const char * line;                // Start of the current row, or the end of the file
+			const char * next;                // Start of the line after it
+			const char * end;
+			Row row{};
+			std::string * scratch;
+			
+			public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = Row;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const Row *;
+			using reference = const Row &;
+			
+			iterator(const char * begin, const char * end, std::string * scratch) : line(begin), next(begin), end(end), scratch(scratch) {
+				advance();
+			}
+			
+			inline reference operator*() const noexcept { return row; }
+			inline pointer operator->() const noexcept { return &row; }
+			inline iterator & operator++() { advance(); return *this; }
+			inline bool operator==(const iterator & other) const noexcept { return line == other.line; }
+			inline bool operator!=(const iterator & other) const noexcept { return line != other.line; }
+			
+			private:
+			/// Moves to the next non-empty line, splitting lines the same way as scan()
+			void advance() {
+				while (next < end) {
+					line = next;
+					const auto lineEnd = DatabaseScan::findLineEnd(next, end);
+					next = DatabaseScan::nextLine(lineEnd, end);
+					if (lineEnd > line) {
+						row = Row(line, lineEnd, scratch);
+						return;
+					}
+				}
+				line = end;
+			}
+		};
+		
+		explicit Rows(const std::string & filename) : file(filename) {}
+		
+		[[nodiscard]] inline bool valid() const noexcept { return file.valid(); }
+		iterator begin() { return iterator(file.begin(), file.end(), &scratch); }
+		iterator end() { return iterator(file.end(), file.end(), &scratch); }
+	};
+	
+	/// The rows of the file as a range; see Rows
+	[[nodiscard]] Rows scan() const { return Rows(filename); }
+	
+	private:
+	/// Parses a line containing escapes into `scratch`, returning its terminator
+	static const char * scanEscaped(const char * p, const char * end, DatabaseRowView & row, std::string & scratch, int & column) {
+		std::array<size_t, columns + 1> bounds{};
+		scratch.clear();
+		column = 0;
+		bool escaped = false;
+		for (; p < end && !DatabaseScan::isLineEnd(*p); p++) {
+			if (*p == '\\') {
+				if (escaped)
+					scratch += '\\';
+				escaped = !escaped;
+				continue;
+			}
+			if (*p == delimeter && !escaped) {
+				if (column < columns)
+					bounds[column + 1] = scratch.length();
+				column++;
+				continue;
+			}
+			scratch += *p;
+			escaped = false;
+		}
+		if (column < columns)
+			bounds[column + 1] = scratch.length();
+		column++;
+		// Missing columns read as empty, for Rows; scan() skips the row
+		for (int i = 0; i < columns; i++)
+			row[i] = i < column ? std::string_view(scratch.data() + bounds[i], bounds[i + 1] - bounds[i]) : std::string_view();
+		return p;
+	}
+	
+	protected:
+	int readFromFile(ReadDatabaseRowFunction op) {
+		DatabaseRow data{};
+		return scan([&](const DatabaseRowView & row) {
+			for (int i = 0; i < columns; i++)
+				data[i].assign(row[i].data(), row[i].length());
+			return op(data);
+		});
+	}
+	
+	[[nodiscard]] struct stat statFile() const {
+		struct stat info{};
+		if (stat(filename.c_str(), &info) != 0)
+			info = {}; // A missing file reads as empty; its creation will show as a new inode
+		return info;
+	}
+	
+	/// Opens the file and takes its lock, trying again if it is replaced before the lock is taken.
+	/// Rewrites rename over the file while holding the lock, so what is appended under it stays.
+	int openLocked(int flags) const {
+		while (true) {
+			const int fd = open(filename.c_str(), flags | O_CLOEXEC, APPENDABLE_MODE);
+			if (fd < 0)
+				return -1;
+			struct stat opened{};
+			if (flock(fd, LOCK_EX) != 0 || fstat(fd, &opened) != 0) {
+				close(fd);
+				return -1;
+			}
+			const auto info = statFile();
+			if (opened.st_dev == info.st_dev && opened.st_ino == info.st_ino)
+				return fd;
 			close(fd);
+		}
+	}
+	
+	/// Whether two stat()s are of the same, unmodified file
+	static bool sameFile(const struct stat & a, const struct stat & b) noexcept {
+		return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size
+				&& a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+	}
+	
+	/**
+	 * Writes a new file through `op` and renames it over the old one, so readers see one or the
+	 * other. Each call writes to its own temporary file, so concurrent rewrites don't mix. The
+	 * new file is left appendable, so insert() keeps appending to it.
+	 *
+	 * If `expected` is given, the file is only replaced if it still matches that stat(), and
+	 * its lock is held across the check and the rename so no insert(), from this process or
+	 * another, can slip in between. Otherwise fails with errno set to ESTALE. `written` gets
+	 * the stat() of the new file as written, before anything can be appended to it.
+	 */
+	bool updateFile(const std::function<bool(RowWriter & writer)> & op, mode_t mode = APPENDABLE_MODE,
+			const struct stat * expected = nullptr, struct stat * written = nullptr) const {
+		auto tmpfile = filename + ".XXXXXX";
+		int fd = mkostemp(&tmpfile[0], O_CLOEXEC);
+		if (fd < 0)
+			return false;
+		RowWriter writer(fd, delimeter);
+		if (!op(writer) || !writer.flush()) {
+			close(fd);
+			unlink(tmpfile.c_str());
 			return false;
 		}
 		
-		if (fchmod(fd, S_IRUSR | S_IRGRP | S_IROTH) != 0) {
-			fprintf(stderr, "Failed to change temp file to read-only: %s\n", strerror(errno));
+		if (fchmod(fd, mode) != 0) {
+			fprintf(stderr, "Failed to change temp file permissions: %s\n", strerror(errno));
+			close(fd);
+			unlink(tmpfile.c_str());
+			return false;
+		}
+		
+		// Otherwise the rename can reach the disk before the rows do
+		if (durable && fdatasync(fd) != 0) {
+			close(fd);
+			unlink(tmpfile.c_str());
 			return false;
 		}
 		
+		if (written != nullptr && fstat(fd, written) != 0)
+			*written = {};
 		close(fd);
-		if (rename(tmpfile.c_str(), filename.c_str()) != 0) {
+		int current = -1;
+		if (expected != nullptr) {
+			current = openLocked(O_RDONLY); // A missing file stays unlocked, and stats as empty
+			if (!sameFile(statFile(), *expected)) {
+				if (current >= 0)
+					close(current);
+				unlink(tmpfile.c_str());
+				errno = ESTALE;
+				return false;
+			}
+		}
+		const bool renamed = rename(tmpfile.c_str(), filename.c_str()) == 0;
+		if (!renamed) {
 			fprintf(stdout, "Failed to copy over temp file: %s\n", strerror(errno));
+			unlink(tmpfile.c_str());
+		}
+		if (current >= 0)
+			close(current);
+		return renamed && (!durable || syncDirectory());
+	}
+	
+	/// Flushes the directory holding the file, so that creating or renaming it is on disk too
+	bool syncDirectory() const {
+		const auto slash = filename.rfind('/');
+		const auto directory = slash == std::string::npos ? std::string(".") : filename.substr(0, slash + 1);
+		const int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
 			return false;
+		const bool synced = fsync(fd) == 0;
+		close(fd);
+		return synced;
+	}
+	
+};
+
+/// Rate-limits the stat() that in-memory copies of a file make to see whether it has changed
+class StatThrottle {
+	std::atomic<std::chrono::steady_clock::rep> checked{0}; // When the file was last stat()ed
+	
+	public:
+	static constexpr std::chrono::steady_clock::duration INTERVAL = std::chrono::milliseconds(1);
+	
+	/// Whether INTERVAL has passed since the last check, claiming the check if so
+	bool due() noexcept {
+		const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+		auto last = checked.load(std::memory_order_relaxed);
+		return now - last >= INTERVAL.count() && checked.compare_exchange_strong(last, now, std::memory_order_relaxed);
+	}
+};
+
+/**
+ * A Database that keeps its rows in memory, with a hash index on `keyColumn`. The file is only
+ * parsed again when its inode, size or modification time changes, or after reload(). Lookups
+ * check with a stat() at most once every STAT_INTERVAL, so changes made by other processes show
+ * up within that long; a watched CachedDatabase skips the stat altogether. Writes go through to
+ * the file as usual.
+ *
+ * replace() instead appends the new row to a write-ahead log, `<file>.wal`, which is replayed
+ * over the file whenever it is loaded. Once COMPACT_AFTER records have built up, the log is
+ * renamed to `<file>.wal.old` and a background thread rewrites the file from a snapshot of the
+ * rows, then deletes the old log. Replaying a record twice is harmless, so a crash at any point
+ * loses nothing that was logged. The log and the file are durable Databases: replace() returns
+ * once its record is on disk, and the old log is only deleted once the rewrite is, so this holds
+ * for a power cut too, not just the process crashing.
+ *
+ * Lookups may come from any thread. They read an immutable Snapshot through std::atomic_load,
+ * so they never wait on the writer mutex or on file I/O. They aren't lock-free, though: the
+ * shared_ptr overloads of atomic_load/store guard the pointer with a spinlock of their own in
+ * libstdc++, held only while the pointer and its count are copied. Writers are serialised by a
+ * mutex and publish a new Snapshot. replace() copies only the few most recent changes; older
+ * ones are folded into a shared map every RECENT_LIMIT changes.
+ */
+template<int columns, char delimeter = ',', int keyColumn = 0>
+class CachedDatabase : public Database<columns, delimeter> {
+	using Base = Database<columns, delimeter>;
+	
+	public:
+	using DatabaseRow = typename Base::DatabaseRow;
+	using DatabaseRowView = typename Base::DatabaseRowView;
+	using FindDatabaseRowFunction = typename Base::FindDatabaseRowFunction;
+	using UpdateDatabaseRowFunction = typename Base::UpdateDatabaseRowFunction;
+	
+	static constexpr size_t COMPACT_AFTER = 1024; // Logged changes
+	static constexpr size_t RECENT_LIMIT = 64;
+	static constexpr std::chrono::steady_clock::duration STAT_INTERVAL = StatThrottle::INTERVAL;
+	
+	private:
+	struct Table {
+		std::vector<DatabaseRow> rows{};                   // In file order
+		std::unordered_map<std::string, size_t> index{};   // First row with each key
+	};
+	
+	using Changes = std::unordered_map<std::string, DatabaseRow>; // By key
+	
+	struct Snapshot {
+		std::shared_ptr<const Table> table;        // The file, as loaded or compacted
+		std::shared_ptr<const Changes> folded;     // Logged since
+		Changes recent{};                          // Logged after those, and newer
+		struct stat file{};                        // What `table` was read from
+		
+		[[nodiscard]] size_t changeCount() const noexcept { return folded->size() + recent.size(); }
+		
+		[[nodiscard]] const DatabaseRow * changed(const std::string & key) const {
+			auto change = recent.find(key);
+			if (change != recent.end())
+				return &change->second;
+			change = folded->find(key);
+			return change == folded->end() ? nullptr : &change->second;
+		}
+		
+		[[nodiscard]] const DatabaseRow * get(const std::string & key) const {
+			if (const auto row = changed(key))
+				return row;
+			const auto row = table->index.find(key);
+			return row == table->index.end() ? nullptr : &table->rows[row->second];
 		}
+		
+		/// Every logged change, newest for each key
+		[[nodiscard]] Changes changes() const {
+			auto all = *folded;
+			for (const auto & change : recent)
+				all[change.first] = change.second;
+			return all;
+		}
+	};
+	
+	const std::string logFile;
+	const std::string oldLogFile;                      // The log being compacted
+	std::shared_ptr<const Snapshot> current{};         // Only through std::atomic_load/store
+	std::mutex writer;
+	std::condition_variable idle;                      // Signalled when a compaction finishes
+	bool compacting = false;
+	std::thread compaction{};
+	std::atomic<bool> watched{false};                  // Lookups trust the snapshot without a stat()
+	StatThrottle stats{};                              // Spaces out the stat() lookups make
+	
+	public:
+	explicit CachedDatabase(std::string filename) : Base(filename, true), logFile(filename + ".wal"), oldLogFile(filename + ".wal.old") {}
+	CachedDatabase(const CachedDatabase &) = delete;
+	CachedDatabase& operator=(const CachedDatabase &) = delete;
+	~CachedDatabase() {
+		std::unique_lock<std::mutex> lock(writer);
+		waitForCompaction(lock);
+	}
+	
+	/// The first row whose key column equals `key`
+	std::optional<DatabaseRow> get(const std::string & key) {
+		const auto snapshot = pin();
+		const auto row = snapshot->get(key);
+		if (row == nullptr)
+			return std::nullopt;
+		return *row;
+	}
+	
+	/// Same as Database::find, but scans the cached rows instead of the file
+	std::optional<DatabaseRow> find(FindDatabaseRowFunction op) {
+		const auto snapshot = pin();
+		const auto & table = *snapshot->table;
+		for (size_t i = 0; i < table.rows.size(); i++) {
+			const auto * row = &table.rows[i];
+			if (snapshot->changeCount() > 0 && table.index.at((*row)[keyColumn]) == i)
+				row = snapshot->get((*row)[keyColumn]);
+			if (op(*row))
+				return *row;
+		}
+		for (const auto * changes : {&snapshot->recent, snapshot->folded.get()}) {
+			for (const auto & change : *changes) {
+				if (table.index.count(change.first) == 0 && snapshot->changed(change.first) == &change.second && op(change.second))
+					return change.second;
+			}
+		}
+		return std::nullopt;
+	}
+	
+	/// Rewrites the file from the cached rows, which takes in the log
+	bool update(UpdateDatabaseRowFunction op) {
+		std::unique_lock<std::mutex> lock(writer);
+		waitForCompaction(lock);
+		bool written = false;
+		do {
+			const auto snapshot = load();
+			const auto table = merge(*snapshot);
+			written = this->updateFile([&](RowWriter & writer) {
+				for (const auto & row : table->rows)
+					writer.writeRow(op(row));
+				return true;
+			}, Base::APPENDABLE_MODE, &snapshot->file);
+		} while (!written && errno == ESTALE); // Changed by another process since it was loaded
+		if (written) {
+			unlink(oldLogFile.c_str());
+			unlink(logFile.c_str());
+		}
+		std::atomic_store(&current, std::shared_ptr<const Snapshot>());
+		return written;
+	}
+	
+	bool insert(const DatabaseRow & data) {
+		std::lock_guard<std::mutex> lock(writer);
+		std::atomic_store(&current, std::shared_ptr<const Snapshot>());
+		return Base::insert(data);
+	}
+	
+	bool insert(const std::vector<DatabaseRow> & rows) {
+		std::lock_guard<std::mutex> lock(writer);
+		std::atomic_store(&current, std::shared_ptr<const Snapshot>());
+		return Base::insert(rows);
+	}
+	
+	/// Replaces the first row with the same key as `row`, or adds it, with one append to the log
+	bool replace(const DatabaseRow & row) {
+		std::lock_guard<std::mutex> lock(writer);
+		const auto snapshot = load();
+		if (!Base(logFile, true).insert(row))
+			return false;
+		auto next = std::make_shared<Snapshot>(*snapshot);
+		next->recent[row[keyColumn]] = row;
+		if (next->recent.size() >= RECENT_LIMIT) {
+			next->folded = std::make_shared<const Changes>(next->changes());
+			next->recent.clear();
+		}
+		std::atomic_store(&current, std::shared_ptr<const Snapshot>(next));
+		if (next->changeCount() >= COMPACT_AFTER)
+			compact(next);
 		return true;
 	}
 	
-	void writeToFile(int fd, const DatabaseRow & data) {
-		std::array<char, 1> comma = {delimeter};
-		int columnIndex = 0;
-		for (const std::string & col : data) {
-			if (columnIndex > 0)
-				write(fd, comma.data(), 1);
-			write(fd, col.c_str(), col.length());
-			columnIndex++;
+	/// Parses the file again on the next lookup, whether or not it looks changed
+	void reload() noexcept { std::atomic_store(&current, std::shared_ptr<const Snapshot>()); }
+	
+	/// Whether something else, such as a FileWatcher, calls refresh() when the file changes
+	inline void setWatched(bool watch) noexcept { watched.store(watch, std::memory_order_relaxed); }
+	
+	/// Parses the file again if it has changed and swaps it in. Safe to call from any thread;
+	/// the parse runs without the writer lock, so lookups and replace() carry on meanwhile.
+	void refresh() {
+		const auto info = this->statFile();
+		const auto snapshot = std::atomic_load(&current);
+		if (snapshot && Base::sameFile(snapshot->file, info))
+			return;
+		auto table = readTable();
+		
+		std::lock_guard<std::mutex> lock(writer);
+		// Replaced again while it was read, which will be refreshed in turn, or loaded already
+		const auto latest = std::atomic_load(&current);
+		if (!Base::sameFile(info, this->statFile()) || (latest && Base::sameFile(latest->file, info)))
+			return;
+		publish(std::move(table), info);
+	}
+	
+	private:
+	/// The current snapshot, reloaded first if the file has changed
+	std::shared_ptr<const Snapshot> pin() {
+		auto snapshot = std::atomic_load(&current);
+		if (snapshot && (watched.load(std::memory_order_relaxed) || !stats.due() || Base::sameFile(snapshot->file, this->statFile())))
+			return snapshot;
+		std::lock_guard<std::mutex> lock(writer);
+		snapshot = load();
+		if (snapshot->changeCount() >= COMPACT_AFTER)
+			compact(snapshot);
+		return snapshot;
+	}
+	
+	/// Same as pin(), for callers holding the writer lock, but never starts a compaction
+	std::shared_ptr<const Snapshot> load() {
+		auto snapshot = std::atomic_load(&current);
+		const auto info = this->statFile();
+		if (snapshot && Base::sameFile(snapshot->file, info))
+			return snapshot;
+		return publish(readTable(), info);
+	}
+	
+	std::shared_ptr<const Table> readTable() {
+		auto table = std::make_shared<Table>();
+		this->readFromFile([&](const DatabaseRow & row) {
+			table->index.emplace(row[keyColumn], table->rows.size());
+			table->rows.push_back(row);
+			return true;
+		});
+		return table;
+	}
+	
+	/// Swaps in the table read from `info` with the logs replayed over it. Called with the writer lock held.
+	std::shared_ptr<const Snapshot> publish(std::shared_ptr<const Table> table, const struct stat & info) {
+		auto changes = std::make_shared<Changes>();
+		replay(oldLogFile, *changes);
+		replay(logFile, *changes);
+		auto next = std::make_shared<Snapshot>();
+		next->table = std::move(table);
+		next->folded = std::move(changes);
+		next->file = info;
+		std::shared_ptr<const Snapshot> snapshot = next;
+		std::atomic_store(&current, snapshot);
+		return snapshot;
+	}
+	
+	static void replay(const std::string & log, Changes & changes) {
+		DatabaseRow row{};
+		Base(log).scan([&](const DatabaseRowView & view) {
+			for (int i = 0; i < columns; i++)
+				row[i].assign(view[i].data(), view[i].length());
+			changes[row[keyColumn]] = row;
+			return true;
+		});
+	}
+	
+	/// The snapshot's table with its changes applied
+	static std::shared_ptr<const Table> merge(const Snapshot & snapshot) {
+		if (snapshot.changeCount() == 0)
+			return snapshot.table;
+		auto table = std::make_shared<Table>(*snapshot.table);
+		for (const auto & change : snapshot.changes()) {
+			const auto existing = table->index.find(change.first);
+			if (existing != table->index.end()) {
+				table->rows[existing->second] = change.second;
+			} else {
+				table->index.emplace(change.first, table->rows.size());
+				table->rows.push_back(change.second);
+			}
 		}
-		write(fd, "\n", 1);
+		return table;
+	}
+	
+	/// Starts folding the log into the file. Called with the writer lock held.
+	void compact(const std::shared_ptr<const Snapshot> & snapshot) {
+		if (compacting)
+			return;
+		if (compaction.joinable())
+			compaction.join();
+		// An old log left by a failed compaction is still unfolded, so keep it and let the new log
+		// grow; it is folded in too, since the snapshot has everything replayed so far
+		struct stat info{};
+		if (stat(oldLogFile.c_str(), &info) != 0 && rename(logFile.c_str(), oldLogFile.c_str()) != 0)
+			return;
+		compacting = true;
+		
+		compaction = std::thread([this, snapshot]() {
+			const auto table = merge(*snapshot);
+			// Rows another process added since the snapshot aren't in it, so give up if there are
+			// any; the old log is kept, and the next load replays it over the file as it is now
+			struct stat file{};
+			const bool written = this->updateFile([&](RowWriter & writer) {
+				for (const auto & row : table->rows)
+					writer.writeRow(row);
+				return true;
+			}, Base::APPENDABLE_MODE, &snapshot->file, &file);
+			if (written)
+				unlink(oldLogFile.c_str());
+			
+			std::lock_guard<std::mutex> lock(writer);
+			const auto latest = std::atomic_load(&current);
+			// A reload since has replayed the logs itself; otherwise keep the changes made since
+			// the snapshot and swap in the rewritten file without parsing it
+			if (written && latest && latest->table == snapshot->table) {
+				auto changes = std::make_shared<Changes>();
+				for (const auto & change : latest->changes()) {
+					const auto folded = snapshot->changed(change.first);
+					if (folded == nullptr || *folded != change.second)
+						changes->emplace(change);
+				}
+				auto next = std::make_shared<Snapshot>();
+				next->table = table;
+				next->folded = std::move(changes);
+				next->file = file; // What `table` holds, even if another process has appended since
+				std::atomic_store(&current, std::shared_ptr<const Snapshot>(next));
+			}
+			compacting = false;
+			idle.notify_all();
+		});
 	}
 	
-};
\ No newline at end of file
+	void waitForCompaction(std::unique_lock<std::mutex> & lock) {
+		idle.wait(lock, [this] { return !compacting; });
+		if (compaction.joinable())
+			compaction.join();
+	}
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Reports changes to files through inotify, so caches of them don't have to stat() on every
+ * lookup. Each file's directory is watched rather than the file, which also catches a file
+ * being replaced by rename, as Database rewrites do. The Selector watches getFD(), and the loop
+ * calls handleEvents() when it becomes readable; each changed file's callback then runs once.
+ */
+class FileWatcher {
+	struct Watch {
+		int directory;
+		std::string name;
+		std::function<void()> onChange;
+	};
+	
+	int fd = -1;
+	std::vector<Watch> watches{};
+	
+	public:
+	FileWatcher();
+	FileWatcher(const FileWatcher &) = delete;
+	FileWatcher& operator=(const FileWatcher &) = delete;
+	~FileWatcher();
+	
+	/// Returns false if inotify isn't available; the caller should keep checking the file itself
+	bool watch(const std::string & filename, std::function<void()> onChange);
+	[[nodiscard]] inline int getFD() const noexcept { return fd; }
+	/// Reads every pending event and runs the callbacks of the files they touch
+	void handleEvents();
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <NetworkMessage.h>
+#include <exceptions.h>
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <type_traits>
+
+/**
+ * Routes frames to handlers on `Context` through a table indexed by MessageType, built at
+ * compile time:
+ *
+ *     static constexpr auto dispatcher = MessageDispatcher<TCPServer, User>()
+ *             .on<HelloMessage, &TCPServer::onReadHelloRequest>()
+ *             .otherwise<&TCPServer::onReadUnknown>();
+ *
+ * Each frame's header is parsed once and its payload is decoded in place, so handlers receive
+ * a view that borrows from the read buffer and is only valid for the duration of the call.
+ */
+template<typename T, typename = void>
+struct DispatchPauseSlot { using type = std::nullptr_t; }; // Connections without data can't pause
+
+template<typename T>
+struct DispatchPauseSlot<T, std::enable_if_t<std::is_class_v<T>>> { using type = bool T::*; };
+
+template<typename Context, typename T>
+class MessageDispatcher {
+	using DataPointer = const std::shared_ptr<T>&;
+	using PauseSlot = typename DispatchPauseSlot<T>::type;
+	using FrameHandler = void(*)(Context &, int, DataPointer, MessageType, const BufferByte *, size_t);
+	
+	std::array<FrameHandler, 256> handlers{};
+	FrameHandler unknownHandler = &skipFrame;
+	std::optional<uint64_t> Context::* requestSlot = nullptr;
+	PauseSlot pauseSlot = nullptr;
+	
+	public:
+	constexpr MessageDispatcher() = default;
+	
+	template<typename MessageT, void (Context::*HANDLER)(int, DataPointer, const MessageT &)>
+	constexpr MessageDispatcher & on() {
+		handlers[static_cast<uint8_t>(MessageT::TYPE)] = &decodeFrame<MessageT, HANDLER>;
+		if constexpr (MessageT::COMPRESSIBLE)
+			handlers[static_cast<uint8_t>(MessageT::TYPE) | FrameHeader::COMPRESSED] = &decodeFrame<MessageT, HANDLER>;
+		return *this;
+	}
+	
+	/// Silently drops frames of this type
+	constexpr MessageDispatcher & ignore(MessageType type) {
+		handlers[static_cast<uint8_t>(type)] = &skipFrame;
+		return *this;
+	}
+	
+	/// Called for any type without a handler. Unknown frames are skipped by default.
+	template<void (Context::*HANDLER)(int, DataPointer, MessageType)>
+	constexpr MessageDispatcher & otherwise() {
+		unknownHandler = &unknownFrame<HANDLER>;
+		return *this;
+	}
+	
+	/// Accepts frames with FrameHeader::REQUEST_ID set. The ID is stripped from the payload and
+	/// stored in `context.*SLOT` while the message is handled, so that replies can carry it.
+	template<std::optional<uint64_t> Context::* SLOT>
+	constexpr MessageDispatcher & requestIds() {
+		requestSlot = SLOT;
+		return *this;
+	}
+	
+	/// Stops dispatching a connection's frames while `data->*SLOT` is set. The rest stay in the
+	/// buffer until dispatch is called again.
+	template<PauseSlot SLOT>
+	constexpr MessageDispatcher & pausedBy() {
+		pauseSlot = SLOT;
+		return *this;
+	}
+	
+	/// Handles every complete frame in the buffer, leaving any trailing partial frame in place.
+	/// Extended frames are only accepted from peers that negotiated `extendedFraming`.
+	/// Throws socket_error if the stream is malformed.
+	void dispatch(Context & context, int fd, DataPointer data, DynamicBuffer & buffer, bool extendedFraming = false) const {
+		FrameHeader header{};
+		while (!paused(data) && FrameHeader::peek(buffer, header)) {
+			if (header.size < header.headerLength || (header.extended() && !extendedFraming))
+				throw socket_error("received malformed frame of size " + std::to_string(header.size));
+			if (buffer.length() < header.size)
+				return;
+			const auto frame = buffer.contiguous(header.size);
+			dispatchFrame(context, fd, data, header.type, frame + header.headerLength, header.payloadLength());
+			buffer.advanceBuffer(header.size);
+		}
+	}
+	
+	/// Dispatches a single, already-framed payload
+	inline void dispatchFrame(Context & context, int fd, DataPointer data, MessageType type, const BufferByte * payload, size_t length) const {
+		if ((static_cast<uint8_t>(type) & FrameHeader::REQUEST_ID) != 0 && requestSlot != nullptr) {
+			dispatchRequest(context, fd, data, type, payload, length);
+			return;
+		}
+		const auto handler = handlers[static_cast<uint8_t>(type)];
+		(handler != nullptr ? handler : unknownHandler)(context, fd, data, type, payload, length);
+	}
+	
+	private:
+	[[nodiscard]] inline bool paused(DataPointer data) const noexcept {
+		if constexpr (std::is_class_v<T>)
+			return pauseSlot != nullptr && (*data).*pauseSlot;
+		return false;
+	}
+	
+	void dispatchRequest(Context & context, int fd, DataPointer data, MessageType type, const BufferByte * payload, size_t length) const {
+		uint64_t id = 0;
+		const auto consumed = Varint::decode(payload, length, id);
+		if (consumed == 0)
+			throw socket_error("received malformed request ID");
+		
+		auto & slot = context.*requestSlot;
+		const auto outer = slot;
+		slot = id;
+		try {
+			const auto untagged = static_cast<MessageType>(static_cast<uint8_t>(type) & ~FrameHeader::REQUEST_ID);
+			dispatchFrame(context, fd, data, untagged, payload + consumed, length - consumed);
+		} catch (...) {
+			slot = outer;
+			throw;
+		}
+		slot = outer;
+	}
+	
+	template<typename MessageT, void (Context::*HANDLER)(int, DataPointer, const MessageT &)>
+	static void decodeFrame(Context & context, int fd, DataPointer data, MessageType type, const BufferByte * payload, size_t length) {
+		MessageT message{};
+		if (!message.decode(payload, length))
+			throw socket_error("received malformed message of type " + std::to_string(static_cast<int>(MessageT::TYPE)));
+		if constexpr (MessageT::COMPRESSIBLE)
+			message.compressed = (static_cast<uint8_t>(type) & FrameHeader::COMPRESSED) != 0;
+		(context.*HANDLER)(fd, data, message);
+	}
+	
+	template<void (Context::*HANDLER)(int, DataPointer, MessageType)>
+	static void unknownFrame(Context & context, int fd, DataPointer data, MessageType type, const BufferByte *, size_t) {
+		(context.*HANDLER)(fd, data, type);
+	}
+	
+	static void skipFrame(Context &, int, DataPointer, MessageType, const BufferByte *, size_t) {}
+};
@@ -2,9 +2,15 @@
 
 #include <Selector.h>
 
+#include <array>
 #include <cstdint>
 #include <cassert>
+#include <functional>
 #include <memory>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <netinet/in.h>
 
 enum class MessageType : uint8_t {
@@ -22,283 +28,664 @@ enum class MessageType : uint8_t {
 	LOGIN_SET_PASSWORD          = 11,
 	LOGIN_SET_PASSWORD_RESPONSE = 12,
 	LOGIN_AUTHENTICATE          = 13,
-	LOGIN_AUTHENTICATE_RESPONSE = 14
+	LOGIN_AUTHENTICATE_RESPONSE = 14,
+	BATCH                       = 15,
+	STREAM_BEGIN                = 16,
+	STREAM_CHUNK                = 17,
+	STREAM_END                  = 18
 };
 
-/* Not ideal.. but works for the time being */
-#define HANDLE_MESSAGE(FUNCTION, MESSAGE_TYPE)  {\
-                                                    MESSAGE_TYPE msg;\
-                                                    if (msg.get(buffer)) \
-                                                        FUNCTION(fd, data, msg); \
-                                                    else \
-                                                    	ready = false; \
-                                                }
+/// Optional protocol capabilities, offered and accepted in HELLO. Neither side uses one until
+/// both have agreed to it, so peers that predate a capability keep working unchanged.
+struct Capability {
+	static constexpr uint8_t  PROTOCOL_VERSION = 1;
+	
+	static constexpr uint32_t EXTENDED_FRAMING = 1u << 0u;
+	static constexpr uint32_t STREAMS          = 1u << 1u;
+	static constexpr uint32_t BATCHING         = 1u << 2u;
+	static constexpr uint32_t COMPRESSION      = 1u << 3u;
+	static constexpr uint32_t REQUEST_IDS      = 1u << 4u;
+	static constexpr uint32_t COMPRESSION_ZLIB = 1u << 5u; // Only offered by builds with zlib, see Compression
+	static constexpr uint32_t SUPPORTED        = EXTENDED_FRAMING | STREAMS | BATCHING | COMPRESSION | REQUEST_IDS;
+};
+/// Unsigned LEB128: 7 bits per byte, least significant group first, high bit set on all but the last
+struct Varint {
+	static constexpr size_t MAX_LENGTH = 10;
+	
+	static constexpr size_t length(uint64_t value) noexcept {
+		size_t length = 1;
+		for (; value >= 0x80u; value >>= 7u)
+			length++;
+		return length;
+	}
+	
+	static inline size_t encode(BufferByte * dst, uint64_t value) noexcept {
+		size_t i = 0;
+		for (; value >= 0x80u; value >>= 7u)
+			dst[i++] = static_cast<BufferByte>((value & 0x7Fu) | 0x80u);
+		dst[i++] = static_cast<BufferByte>(value);
+		return i;
+	}
+	
+	/// Returns the number of bytes consumed, or 0 if the input is truncated or overlong
+	static inline size_t decode(const BufferByte * src, size_t length, uint64_t & value) noexcept {
+		value = 0;
+		for (size_t i = 0; i < length && i < MAX_LENGTH; i++) {
+			const auto byte = static_cast<uint8_t>(src[i]);
+			value |= static_cast<uint64_t>(byte & 0x7Fu) << (7u * i);
+			if ((byte & 0x80u) == 0)
+				return i + 1;
+		}
+		return 0;
+	}
+};
 
-struct Message {
-	uint16_t    size = 0;
+/**
+ * Every frame starts with a 3-byte header: the frame size (header included) as a big-endian
+ * uint16_t, followed by the message type. With extended framing, a frame too large for that
+ * has a size of 0 and the payload length follows the type as a varint. The COMPRESSED bit of
+ * the type byte marks a payload encoded by Compression. The REQUEST_ID bit marks a payload
+ * that starts with a varint request ID, which the reply carries back.
+ */
+struct FrameHeader {
+	static constexpr size_t   LENGTH = 3;
+	static constexpr uint8_t  COMPRESSED = 0x80;
+	static constexpr uint8_t  REQUEST_ID = 0x40;
+	static constexpr size_t   MAX_LENGTH = LENGTH + Varint::MAX_LENGTH;
+	static constexpr uint16_t EXTENDED = 0;
+	// Larger lengths are treated as malformed rather than buffered; use a stream instead
+	static constexpr size_t   MAX_EXTENDED_PAYLOAD = 64u * 1024u * 1024u;
+	
+	size_t      size = 0;          // Whole frame, header included. 0 if the header is malformed.
+	size_t      headerLength = LENGTH;
 	MessageType type = MessageType::UNKNOWN;
 	
-	Message() = default;
-	Message(uint16_t size, MessageType type) : size(size), type(type) {}
-	virtual ~Message() = default;
+	[[nodiscard]] inline size_t payloadLength() const noexcept { return size - headerLength; }
+	[[nodiscard]] inline bool extended() const noexcept { return headerLength > LENGTH; }
 	
-	virtual bool peek(const DynamicBuffer & buffer) {
-		if (buffer.length() < 3)
-			return false;
-		const auto buf = buffer.getNextBuffer();
-		peekHeader(buf);
-		return buf->length() >= size;
+	static constexpr size_t lengthFor(size_t payloadLength) noexcept {
+		return LENGTH + payloadLength <= UINT16_MAX ? LENGTH : LENGTH + Varint::length(payloadLength);
 	}
 	
-	virtual bool get(DynamicBuffer & buffer) {
-		bool success = peek(buffer);
-		if (success)
-			buffer.advanceBuffer(size);
-		return success;
+	static constexpr size_t frameLength(size_t payloadLength) noexcept {
+		return lengthFor(payloadLength) + payloadLength;
 	}
 	
-	virtual std::shared_ptr<Buffer> encode() {
-		std::array<BufferByte, 3> encoded {};
-		*reinterpret_cast<uint16_t*>(encoded.data()) = htons(size);
-		encoded[2] = static_cast<uint8_t>(type);
-		return std::make_shared<Buffer>(encoded.data(), 3);
+	/// The header length within an encoded frame of `frameLength` bytes
+	static constexpr size_t lengthOfFrame(size_t frameLength) noexcept {
+		if (frameLength <= UINT16_MAX)
+			return LENGTH;
+		size_t varintLength = 1;
+		while (Varint::length(frameLength - LENGTH - varintLength) != varintLength)
+			varintLength++;
+		return LENGTH + varintLength;
 	}
 	
-	void peekHeader(const std::shared_ptr<Buffer> & buf) {
-		size = ntohs(*reinterpret_cast<const uint16_t*>(buf->data()));
-		type = static_cast<MessageType>(buf->get(2));
+	/// Returns false until the whole header has arrived
+	static bool peek(const DynamicBuffer & buffer, FrameHeader & header) {
+		std::array<uint8_t, MAX_LENGTH> raw{};
+		if (!buffer.peekNext(raw.data(), LENGTH))
+			return false;
+		header.size = static_cast<size_t>(raw[0] << 8u | raw[1]);
+		header.headerLength = LENGTH;
+		header.type = static_cast<MessageType>(raw[2]);
+		if (header.size != EXTENDED)
+			return true;
+		
+		const auto available = std::min(buffer.length(), raw.size());
+		buffer.peekNext(raw.data(), available);
+		uint64_t payloadLength = 0;
+		const auto consumed = Varint::decode(reinterpret_cast<const BufferByte *>(raw.data()) + LENGTH, available - LENGTH, payloadLength);
+		if (consumed == 0)
+			return available == raw.size(); // Overlong, size stays 0
+		if (payloadLength <= MAX_EXTENDED_PAYLOAD) {
+			header.headerLength = LENGTH + consumed;
+			header.size = header.headerLength + payloadLength;
+		}
+		return true;
 	}
 	
-	static std::optional<std::string> peekString(const DynamicBuffer & buffer, size_t index) {
-		uint16_t length = ntohs(static_cast<uint16_t>(static_cast<uint16_t>(buffer[index+1]) << 8u) | static_cast<uint16_t>(buffer[index]));
-		if (length > buffer.length() - index - 2)
-			return std::nullopt;
-		std::string ret(length, ' ');
-		for (size_t i = index+2, retIndex = 0; i < index+length; i++, retIndex++) {
-			ret[retIndex] = buffer[i];
+	/// Writes the header for a payload of `payloadLength` bytes, returning lengthFor(payloadLength)
+	static size_t encode(BufferByte * dst, size_t payloadLength, MessageType type) noexcept {
+		dst[2] = static_cast<BufferByte>(type);
+		if (LENGTH + payloadLength > UINT16_MAX) {
+			dst[0] = dst[1] = 0;
+			return LENGTH + Varint::encode(dst + LENGTH, payloadLength);
 		}
-		return ret;
+		const auto networkSize = htons(static_cast<uint16_t>(LENGTH + payloadLength));
+		memcpy(dst, &networkSize, sizeof(networkSize));
+		return LENGTH;
 	}
 };
 
-struct HelloMessage : public Message {
-	HelloMessage() : Message(3, MessageType::HELLO) {}
-	~HelloMessage() override = default;
-	
-	bool assertValid() {
-		assert(size == 3);
-		assert(type == MessageType::HELLO);
-		return size == 3 && type == MessageType::HELLO;
-	}
+/**
+ * Messages are views over a frame: decode() points string fields into the payload it was
+ * given, and encode() reads them from wherever the caller pointed them. A message must not
+ * outlive the frame or strings it refers to.
+ *
+ * Encoders write into caller-provided memory and return the number of bytes written, or 0 if
+ * `capacity` is too small.
+ */
+struct Message {
+	/// Whether frames of this type may arrive with FrameHeader::COMPRESSED set
+	static constexpr bool COMPRESSIBLE = false;
 };
 
-struct Generic1Message : public Message {
-	Generic1Message() : Message(3, MessageType::GENERIC_1) {}
-	~Generic1Message() override = default;
+/**
+ * Gives a message with `encodedSize()` and `encodeInto(BufferByte *, size_t)` the ability to
+ * encode straight into a DynamicBuffer, so consecutive messages share its tail chunk.
+ */
+template<typename Derived>
+struct EncodableMessage : public Message {
+	void encodeInto(DynamicBuffer & buffer) const {
+		const auto & message = static_cast<const Derived &>(*this);
+		const auto length = message.encodedSize();
+		const auto written = message.encodeInto(buffer.reserve(length), length);
+		assert(written == length);
+		buffer.commit(written);
+	}
 	
-	bool assertValid() {
-		assert(size == 3);
-		assert(type == MessageType::GENERIC_1);
-		return size == 3 && type == MessageType::GENERIC_1;
+	/// Encodes into a standalone buffer. Prefer encodeInto when there is a buffer to append to.
+	[[nodiscard]] std::shared_ptr<Buffer> encode() const {
+		const auto & message = static_cast<const Derived &>(*this);
+		const auto length = message.encodedSize();
+		auto encoded = std::make_shared<Buffer>(length);
+		encoded->commit(message.encodeInto(encoded->tail(), length));
+		return encoded;
 	}
 };
 
-struct Generic2Message : public Message {
-	Generic2Message() : Message(3, MessageType::GENERIC_2) {}
-	~Generic2Message() override = default;
+/// A run of raw bytes within a frame; the binary counterpart of a std::string_view field
+struct Bytes {
+	const BufferByte * data = nullptr;
+	size_t length = 0;
+};
+
+/*
+ * Field codecs give each field type its wire format. FIXED is the encoded size, or 0 if it
+ * depends on the value. `last` is true for the final field of a message, which lets strings
+ * and bytes take the rest of the payload instead of carrying a length. decode() advances
+ * `offset` and returns false if the field runs past `length`.
+ */
+
+/// Integers, enums and bools: big-endian, sizeof(T) bytes
+template<typename T>
+struct FixedField {
+	static_assert(std::is_integral_v<T> || std::is_enum_v<T>, "No wire format for this field type");
+	static constexpr size_t FIXED = sizeof(T);
+	
+	static constexpr size_t size(T, bool) noexcept { return FIXED; }
 	
-	bool assertValid() {
-		assert(size == 3);
-		assert(type == MessageType::GENERIC_2);
-		return size == 3 && type == MessageType::GENERIC_2;
+	static inline BufferByte * encode(BufferByte * dst, T value, bool) noexcept {
+		auto bits = static_cast<uint64_t>(value);
+		for (size_t i = FIXED; i-- > 0; bits >>= 8u)
+			dst[i] = static_cast<BufferByte>(bits & 0xFFu);
+		return dst + FIXED;
+	}
+	
+	static inline bool decode(const BufferByte * payload, size_t length, size_t & offset, T & value, bool) noexcept {
+		if (length - offset < FIXED)
+			return false;
+		uint64_t bits = 0;
+		for (size_t i = 0; i < FIXED; i++)
+			bits = bits << 8u | static_cast<uint8_t>(payload[offset + i]);
+		value = static_cast<T>(bits);
+		offset += FIXED;
+		return true;
 	}
 };
 
-struct Generic3Message : public Message {
-	Generic3Message() : Message(3, MessageType::GENERIC_3) {}
-	~Generic3Message() override = default;
+/// Unsigned integers that are usually small, such as IDs and counts
+struct VarintField {
+	static constexpr size_t FIXED = 0;
+	
+	static constexpr size_t size(uint64_t value, bool) noexcept { return Varint::length(value); }
 	
-	bool assertValid() {
-		assert(size == 3);
-		assert(type == MessageType::GENERIC_3);
-		return size == 3 && type == MessageType::GENERIC_3;
+	static inline BufferByte * encode(BufferByte * dst, uint64_t value, bool) noexcept {
+		return dst + Varint::encode(dst, value);
+	}
+	
+	static inline bool decode(const BufferByte * payload, size_t length, size_t & offset, uint64_t & value, bool) noexcept {
+		const auto consumed = Varint::decode(payload + offset, length - offset, value);
+		offset += consumed;
+		return consumed != 0;
 	}
 };
 
-struct Generic4Message : public Message {
-	Generic4Message() : Message(3, MessageType::GENERIC_4) {}
-	~Generic4Message() override = default;
+/// Strings and Bytes: a varint length then the data, or just the data when last
+struct SpanField {
+	static constexpr size_t FIXED = 0;
+	
+	static constexpr size_t spanSize(size_t spanLength, bool last) noexcept {
+		return (last ? 0 : Varint::length(spanLength)) + spanLength;
+	}
 	
-	bool assertValid() {
-		assert(size == 3);
-		assert(type == MessageType::GENERIC_4);
-		return size == 3 && type == MessageType::GENERIC_4;
+	static inline BufferByte * encodeSpan(BufferByte * dst, const void * data, size_t spanLength, bool last) noexcept {
+		if (!last)
+			dst += Varint::encode(dst, spanLength);
+		memcpy(dst, data, spanLength);
+		return dst + spanLength;
+	}
+	
+	static inline bool decodeSpan(const BufferByte * payload, size_t length, size_t & offset, const BufferByte * & data, size_t & spanLength, bool last) noexcept {
+		if (last) {
+			spanLength = length - offset;
+		} else {
+			uint64_t prefixed = 0;
+			const auto consumed = Varint::decode(payload + offset, length - offset, prefixed);
+			if (consumed == 0 || prefixed > length - offset - consumed)
+				return false;
+			offset += consumed;
+			spanLength = static_cast<size_t>(prefixed);
+		}
+		data = payload + offset;
+		offset += spanLength;
+		return true;
 	}
 };
 
-struct Generic5Message : public Message {
-	Generic5Message() : Message(3, MessageType::GENERIC_5) {}
-	~Generic5Message() override = default;
+struct StringField : public SpanField {
+	static constexpr size_t size(std::string_view value, bool last) noexcept { return spanSize(value.length(), last); }
 	
-	bool assertValid() {
-		assert(size == 3);
-		assert(type == MessageType::GENERIC_5);
-		return size == 3 && type == MessageType::GENERIC_5;
+	static inline BufferByte * encode(BufferByte * dst, std::string_view value, bool last) noexcept {
+		return encodeSpan(dst, value.data(), value.length(), last);
+	}
+	
+	static inline bool decode(const BufferByte * payload, size_t length, size_t & offset, std::string_view & value, bool last) noexcept {
+		const BufferByte * data;
+		size_t spanLength;
+		if (!decodeSpan(payload, length, offset, data, spanLength, last))
+			return false;
+		value = std::string_view(reinterpret_cast<const char *>(data), spanLength);
+		return true;
 	}
 };
 
-struct MenuMessage : public Message {
-	MenuMessage() : Message(3, MessageType::MENU) {}
-	~MenuMessage() override = default;
+struct BytesField : public SpanField {
+	static constexpr size_t size(const Bytes & value, bool last) noexcept { return spanSize(value.length, last); }
 	
-	bool assertValid() {
-		assert(size == 3);
-		assert(type == MessageType::MENU);
-		return size == 3 && type == MessageType::MENU;
+	static inline BufferByte * encode(BufferByte * dst, const Bytes & value, bool last) noexcept {
+		return encodeSpan(dst, value.data, value.length, last);
+	}
+	
+	static inline bool decode(const BufferByte * payload, size_t length, size_t & offset, Bytes & value, bool last) noexcept {
+		return decodeSpan(payload, length, offset, value.data, value.length, last);
 	}
 };
 
-template<MessageType TYPE>
-struct SingleStringMessage : public Message {
-	protected:
-	std::string string;
+/// The codec a field gets unless its Field names another
+template<typename T> struct FieldCodec : public FixedField<T> {};
+template<> struct FieldCodec<std::string_view> : public StringField {};
+template<> struct FieldCodec<Bytes> : public BytesField {};
+
+template<typename T> struct MemberPointer;
+template<typename Class, typename T> struct MemberPointer<T Class::*> { using Type = T; };
+
+/// One field of a schema: the member it lives in, and how it is encoded
+template<auto MEMBER, typename FieldCodecType = FieldCodec<typename MemberPointer<decltype(MEMBER)>::Type>>
+struct Field {
+	static constexpr auto POINTER = MEMBER;
+	using Codec = FieldCodecType;
+};
+
+/**
+ * The wire layout of a message: its Fields, encoded back to back in order. Everything a
+ * message needs to decode and encode itself is generated from this list, so a new message
+ * only has to declare its members and its Schema. Decoding never copies; string and bytes
+ * fields point into the payload. Bytes after the last field are ignored so that messages can
+ * gain fields later.
+ */
+template<typename... Fields>
+struct MessageSchema {
+	static constexpr size_t COUNT = sizeof...(Fields);
+	/// Whether every field has a fixed size, making the frame size a constant
+	static constexpr bool FIXED = ((Fields::Codec::FIXED != 0) && ...);
+	/// The shortest payload that could decode, checked before any field is read
+	static constexpr size_t MIN_LENGTH = (Fields::Codec::FIXED + ... + 0);
 	
-	public:
-	SingleStringMessage() : Message(3, TYPE) {}
-	~SingleStringMessage() override = default;
+	template<typename Target>
+	static inline bool decode(const BufferByte * payload, size_t length, Target & message) noexcept {
+		if (length < MIN_LENGTH)
+			return false;
+		return decode(payload, length, message, std::index_sequence_for<Fields...>{});
+	}
 	
-	bool assertValid() {
-		assert(size == 3+string.length());
-		assert(type == TYPE);
-		return size == 3+string.length() && type == TYPE;
+	template<typename Source>
+	static inline size_t payloadLength(const Source & message) noexcept {
+		if constexpr (FIXED)
+			return MIN_LENGTH;
+		else
+			return payloadLength(message, std::index_sequence_for<Fields...>{});
 	}
 	
-	bool peek(const DynamicBuffer & buffer) override {
-		if (buffer.length() < 3)
-			return false;
-		const auto buf = buffer.getNextBuffer();
-		peekHeader(buf);
-		if (buffer.length() < size)
-			return false;
-		std::string ret(size-3, ' ');
-		for (size_t i = 3, retIndex = 0; i < size; i++, retIndex++) {
-			ret[retIndex] = buffer[i];
-		}
-		string = ret;
-		return true;
+	/// Writes the fields, which must fit in payloadLength(message) bytes, and returns the end
+	template<typename Source>
+	static inline BufferByte * encode(BufferByte * dst, const Source & message) noexcept {
+		return encode(dst, message, std::index_sequence_for<Fields...>{});
 	}
 	
-	bool get(DynamicBuffer & buffer) override {
-		bool success = peek(buffer);
-		if (success)
-			buffer.advanceBuffer(size);
-		return success;
+	private:
+	template<typename Target, size_t... I>
+	static inline bool decode([[maybe_unused]] const BufferByte * payload, [[maybe_unused]] size_t length,
+			[[maybe_unused]] Target & message, std::index_sequence<I...>) noexcept {
+		[[maybe_unused]] size_t offset = 0; // All unused by empty schemas
+		return (Fields::Codec::decode(payload, length, offset, message.*Fields::POINTER, I + 1 == COUNT) && ...);
 	}
 	
-	std::shared_ptr<Buffer> encode() override {
-		std::vector<BufferByte> encoded;
-		auto length = 3 + string.length();
-		encoded.reserve(length);
-		size = length;
-		*reinterpret_cast<uint16_t*>(&encoded[0]) = htons(size);
-		encoded[2] = static_cast<uint8_t>(type);
-		strncpy(reinterpret_cast<char *>(&encoded[3]), string.c_str(), string.length());
-		return std::make_shared<Buffer>(encoded.data(), length);
+	template<typename Source, size_t... I>
+	static inline size_t payloadLength(const Source & message, std::index_sequence<I...>) noexcept {
+		return (Fields::Codec::size(message.*Fields::POINTER, I + 1 == COUNT) + ... + 0);
+	}
+	
+	template<typename Source, size_t... I>
+	static inline BufferByte * encode(BufferByte * dst, const Source & message, std::index_sequence<I...>) noexcept {
+		((dst = Fields::Codec::encode(dst, message.*Fields::POINTER, I + 1 == COUNT)), ...);
+		return dst;
 	}
 };
 
-template<MessageType TYPE>
-struct SingleBooleanMessage : public Message {
-	protected:
-	bool value;
-	
-	public:
-	SingleBooleanMessage() : Message(4, TYPE) {}
-	~SingleBooleanMessage() override = default;
+/**
+ * Base for messages described by a MessageSchema. Derived declares `using Schema = ...` after
+ * its members, and gets decode(), encodedSize() and encodeInto() from it. Encoding sizes the
+ * frame once and writes header and fields straight into the destination.
+ */
+template<typename Derived, MessageType MESSAGE_TYPE>
+struct SchemaMessage : public EncodableMessage<Derived> {
+	static constexpr MessageType TYPE = MESSAGE_TYPE;
 	
-	bool assertValid() {
-		assert(size == 4);
-		assert(type == TYPE);
-		return size == 4 && type == TYPE;
+	inline bool decode(const BufferByte * payload, size_t length) noexcept {
+		return Derived::Schema::decode(payload, length, static_cast<Derived &>(*this));
 	}
 	
-	bool peek(const DynamicBuffer & buffer) override {
-		if (buffer.length() < 4)
-			return false;
-		const auto buf = buffer.getNextBuffer();
-		peekHeader(buf);
-		value = buffer[3];
-		return true;
+	[[nodiscard]] inline size_t encodedSize() const noexcept {
+		return FrameHeader::frameLength(Derived::Schema::payloadLength(static_cast<const Derived &>(*this)));
 	}
 	
-	bool get(DynamicBuffer & buffer) override {
-		bool success = peek(buffer);
-		if (success)
-			buffer.advanceBuffer(size);
-		return success;
+	using EncodableMessage<Derived>::encodeInto;
+	inline size_t encodeInto(BufferByte * dst, size_t capacity) const noexcept {
+		const auto & message = static_cast<const Derived &>(*this);
+		const auto payloadLength = Derived::Schema::payloadLength(message);
+		const auto length = FrameHeader::frameLength(payloadLength);
+		if (capacity < length)
+			return 0;
+		const auto header = FrameHeader::encode(dst, payloadLength, TYPE);
+		[[maybe_unused]] const auto end = Derived::Schema::encode(dst + header, message);
+		assert(end == dst + length);
+		return length;
 	}
+};
+
+template<MessageType MESSAGE_TYPE>
+struct EmptyMessage : public SchemaMessage<EmptyMessage<MESSAGE_TYPE>, MESSAGE_TYPE> {
+	using Schema = MessageSchema<>;
+};
+
+using Generic1Message = EmptyMessage<MessageType::GENERIC_1>;
+using Generic2Message = EmptyMessage<MessageType::GENERIC_2>;
+using Generic3Message = EmptyMessage<MessageType::GENERIC_3>;
+using Generic4Message = EmptyMessage<MessageType::GENERIC_4>;
+using Generic5Message = EmptyMessage<MessageType::GENERIC_5>;
+using MenuMessage     = EmptyMessage<MessageType::MENU>;
+
+/**
+ * A bare HELLO asks for a greeting. One with a payload negotiates instead: it carries the
+ * sender's protocol version (u8) and the Capability bits it offers (big-endian u32), and is
+ * answered with a HELLO carrying the version both sides speak and the capabilities accepted.
+ * Trailing bytes are ignored so that later versions can append to it.
+ *
+ * The negotiation fields are sent together or not at all, so they have a schema of their own.
+ */
+struct HelloMessage : public EncodableMessage<HelloMessage> {
+	static constexpr MessageType TYPE = MessageType::HELLO;
+	bool negotiate = false;
+	uint8_t version = 0;
+	uint32_t capabilities = 0;
+	
+	using Negotiation = MessageSchema<Field<&HelloMessage::version>, Field<&HelloMessage::capabilities>>;
+	
+	HelloMessage() = default;
+	HelloMessage(uint8_t version, uint32_t capabilities) : negotiate(true), version(version), capabilities(capabilities) {}
+	
+	bool decode(const BufferByte * payload, size_t length) noexcept;
+	[[nodiscard]] inline size_t encodedSize() const noexcept { return FrameHeader::LENGTH + (negotiate ? Negotiation::MIN_LENGTH : 0); }
+	using EncodableMessage::encodeInto;
+	size_t encodeInto(BufferByte * dst, size_t capacity) const noexcept;
+};
+
+struct DisplayMessage : public SchemaMessage<DisplayMessage, MessageType::DISPLAY_MESSAGE> {
+	static constexpr bool COMPRESSIBLE = true;
+	std::string_view message;
+	bool compressed = false; // `message` is still compressed; see Compression::decompress. Not sent.
+	
+	using Schema = MessageSchema<Field<&DisplayMessage::message>>;
+	
+	DisplayMessage() = default;
+	explicit DisplayMessage(std::string_view message) : message(message) {}
+};
+
+struct LoginSetUsername : public SchemaMessage<LoginSetUsername, MessageType::LOGIN_SET_USERNAME> {
+	std::string_view username;
+	
+	using Schema = MessageSchema<Field<&LoginSetUsername::username>>;
+	
+	LoginSetUsername() = default;
+	explicit LoginSetUsername(std::string_view username) : username(username) {}
+};
+
+struct LoginSetPassword : public SchemaMessage<LoginSetPassword, MessageType::LOGIN_SET_PASSWORD> {
+	std::string_view password;
+	
+	using Schema = MessageSchema<Field<&LoginSetPassword::password>>;
+	
+	LoginSetPassword() = default;
+	explicit LoginSetPassword(std::string_view password) : password(password) {}
+};
+
+struct LoginAuthenticate : public SchemaMessage<LoginAuthenticate, MessageType::LOGIN_AUTHENTICATE> {
+	std::string_view password;
+	
+	using Schema = MessageSchema<Field<&LoginAuthenticate::password>>;
+	
+	LoginAuthenticate() = default;
+	explicit LoginAuthenticate(std::string_view password) : password(password) {}
+};
+
+template<MessageType MESSAGE_TYPE>
+struct LoginResponse : public SchemaMessage<LoginResponse<MESSAGE_TYPE>, MESSAGE_TYPE> {
+	bool success = false;
+	
+	using Schema = MessageSchema<Field<&LoginResponse::success>>;
 	
-	std::shared_ptr<Buffer> encode() override {
-		std::array<BufferByte, 4> encoded{};
-		*reinterpret_cast<uint16_t*>(&encoded[0]) = htons(size);
-		encoded[2] = static_cast<uint8_t>(type);
-		encoded[3] = (value ? 1 : 0);
-		return std::make_shared<Buffer>(encoded.data(), encoded.size());
+	LoginResponse() = default;
+	explicit LoginResponse(bool success) : success(success) {}
+};
+
+using LoginSetUsernameResponse  = LoginResponse<MessageType::LOGIN_SET_USERNAME_RESPONSE>;
+using LoginSetPasswordResponse  = LoginResponse<MessageType::LOGIN_SET_PASSWORD_RESPONSE>;
+using LoginAuthenticateResponse = LoginResponse<MessageType::LOGIN_AUTHENTICATE_RESPONSE>;
+
+/// Lets an already encoded frame, such as a cached response, be used where a message is expected
+struct EncodedFrame : public EncodableMessage<EncodedFrame> {
+	const Buffer & frame;
+	
+	explicit EncodedFrame(const Buffer & frame) : frame(frame) {}
+	
+	[[nodiscard]] inline size_t encodedSize() const noexcept { return frame.length(); }
+	using EncodableMessage::encodeInto;
+	inline size_t encodeInto(BufferByte * dst, size_t capacity) const noexcept {
+		if (capacity < frame.length())
+			return 0;
+		memcpy(dst, frame.data(), frame.length());
+		return frame.length();
 	}
 };
 
-struct DisplayMessage : public SingleStringMessage<MessageType::DISPLAY_MESSAGE> {
-	std::string & message = SingleStringMessage::string;
+/**
+ * Encodes `message` as the reply to, or with the ID of, request `id`: the type gains
+ * FrameHeader::REQUEST_ID and the payload is prefixed with the ID.
+ */
+template<typename Encodable>
+struct RequestTagged : public EncodableMessage<RequestTagged<Encodable>> {
+	const Encodable & message;
+	uint64_t id;
+	
+	RequestTagged(const Encodable & message, uint64_t id) : message(message), id(id) {}
+	
+	[[nodiscard]] inline size_t encodedSize() const noexcept {
+		const auto frame = message.encodedSize();
+		return FrameHeader::frameLength(Varint::length(id) + frame - FrameHeader::lengthOfFrame(frame));
+	}
 	
-	DisplayMessage() : SingleStringMessage() {}
-	explicit DisplayMessage(std::string message) : SingleStringMessage() { SingleStringMessage::string = std::move(message); }
-	~DisplayMessage() override = default;
+	using EncodableMessage<RequestTagged<Encodable>>::encodeInto;
+	size_t encodeInto(BufferByte * dst, size_t capacity) const noexcept {
+		const auto frame = message.encodedSize();
+		const auto innerHeader = FrameHeader::lengthOfFrame(frame);
+		const auto payloadLength = frame - innerHeader;
+		const auto idLength = Varint::length(id);
+		const auto header = FrameHeader::lengthFor(idLength + payloadLength);
+		const auto length = header + idLength + payloadLength;
+		if (capacity < length)
+			return 0;
+		
+		// Encode the message so that its payload lands in place, then write our header over its own
+		const auto inner = dst + header + idLength - innerHeader;
+		message.encodeInto(inner, frame);
+		const auto type = static_cast<uint8_t>(inner[2]) | FrameHeader::REQUEST_ID;
+		FrameHeader::encode(dst, idLength + payloadLength, static_cast<MessageType>(type));
+		Varint::encode(dst + header, id);
+		return length;
+	}
 };
 
-struct LoginSetUsername : public SingleStringMessage<MessageType::LOGIN_SET_USERNAME> {
-	std::string & username = SingleStringMessage::string;
+/**
+ * A payload too large to hold in one frame, or in memory, is sent as a stream: STREAM_BEGIN,
+ * any number of STREAM_CHUNKs, then STREAM_END, all carrying the same id. Other frames may be
+ * interleaved. `contentType` says how the chunks should be read, e.g. DISPLAY_MESSAGE for text.
+ */
+struct StreamBegin : public SchemaMessage<StreamBegin, MessageType::STREAM_BEGIN> {
+	uint64_t id = 0;
+	MessageType contentType = MessageType::UNKNOWN;
+	
+	using Schema = MessageSchema<Field<&StreamBegin::id, VarintField>, Field<&StreamBegin::contentType>>;
 	
-	LoginSetUsername() : SingleStringMessage() {}
-	explicit LoginSetUsername(std::string username) : SingleStringMessage() { SingleStringMessage::string = std::move(username); }
-	~LoginSetUsername() override = default;
+	StreamBegin() = default;
+	StreamBegin(uint64_t id, MessageType contentType) : id(id), contentType(contentType) {}
 };
 
-struct LoginSetPassword : public SingleStringMessage<MessageType::LOGIN_SET_PASSWORD> {
-	std::string & password = SingleStringMessage::string;
+struct StreamChunk : public SchemaMessage<StreamChunk, MessageType::STREAM_CHUNK> {
+	uint64_t id = 0;
+	Bytes chunk{};
 	
-	LoginSetPassword() : SingleStringMessage() {}
-	explicit LoginSetPassword(std::string password) : SingleStringMessage() { SingleStringMessage::string = std::move(password); }
-	~LoginSetPassword() override = default;
+	using Schema = MessageSchema<Field<&StreamChunk::id, VarintField>, Field<&StreamChunk::chunk>>;
+	
+	StreamChunk() = default;
+	StreamChunk(uint64_t id, const BufferByte * data, size_t length) : id(id), chunk{data, length} {}
 };
 
-struct LoginAuthenticate : public SingleStringMessage<MessageType::LOGIN_AUTHENTICATE> {
-	std::string & password = SingleStringMessage::string;
+struct StreamEnd : public SchemaMessage<StreamEnd, MessageType::STREAM_END> {
+	uint64_t id = 0;
+	bool aborted = false; // The producer failed part way; what was received is incomplete
+	
+	using Schema = MessageSchema<Field<&StreamEnd::id, VarintField>, Field<&StreamEnd::aborted>>;
 	
-	LoginAuthenticate() : SingleStringMessage() {}
-	explicit LoginAuthenticate(std::string password) : SingleStringMessage() { SingleStringMessage::string = std::move(password); }
-	~LoginAuthenticate() override = default;
+	StreamEnd() = default;
+	explicit StreamEnd(uint64_t id, bool aborted = false) : id(id), aborted(aborted) {}
 };
 
-struct LoginSetUsernameResponse : public SingleBooleanMessage<MessageType::LOGIN_SET_USERNAME_RESPONSE> {
-	bool & success = SingleBooleanMessage::value;
+/**
+ * Sends a stream without holding it: each call appends one frame to `out`, pulling at most
+ * CHUNK_SIZE bytes from `source` straight into the write buffer. Returns false once STREAM_END
+ * has been written, so it can be handed to Selector::streamToFD as a write producer.
+ */
+class StreamProducer {
+	public:
+	static constexpr size_t CHUNK_SIZE = 16u * 1024u;
+	/// Fills up to `capacity` bytes and returns how many were written, 0 at the end of the data
+	using Source = std::function<size_t(BufferByte * dst, size_t capacity)>;
+	
+	StreamProducer(uint64_t id, MessageType contentType, Source source) :
+			id(id), contentType(contentType), source(std::move(source)) {}
+	
+	bool operator()(DynamicBuffer & out);
 	
-	LoginSetUsernameResponse() : SingleBooleanMessage() {}
-	explicit LoginSetUsernameResponse(bool success) : SingleBooleanMessage() { SingleBooleanMessage::value = success; }
-	~LoginSetUsernameResponse() override = default;
+	private:
+	uint64_t id;
+	MessageType contentType;
+	Source source;
+	bool begun = false;
 };
 
-struct LoginSetPasswordResponse : public SingleBooleanMessage<MessageType::LOGIN_SET_PASSWORD_RESPONSE> {
-	bool & success = SingleBooleanMessage::value;
+/**
+ * Carries many messages in one frame. The payload is a varint count, then one table entry per
+ * message (its type byte and varint payload length), then the payloads back to back. Messages
+ * inside a batch have no frame header of their own.
+ */
+struct BatchMessage : public Message {
+	static constexpr MessageType TYPE = MessageType::BATCH;
+	size_t count = 0;
 	
-	LoginSetPasswordResponse() : SingleBooleanMessage() {}
-	explicit LoginSetPasswordResponse(bool success) : SingleBooleanMessage() { SingleBooleanMessage::value = success; }
-	~LoginSetPasswordResponse() override = default;
+	BatchMessage() = default;
+	
+	bool decode(const BufferByte * payload, size_t length) noexcept;
+	
+	/// Calls op(MessageType, const BufferByte * payload, size_t length) for each message in order
+	template<typename Op>
+	void forEach(Op && op) const {
+		auto entry = table;
+		auto data = payloads;
+		for (size_t i = 0; i < count; i++) {
+			const auto type = static_cast<MessageType>(*entry++);
+			uint64_t length = 0;
+			entry += Varint::decode(entry, Varint::MAX_LENGTH, length);
+			op(type, data, static_cast<size_t>(length));
+			data += length;
+		}
+	}
+	
+	private:
+	const BufferByte * table = nullptr;
+	const BufferByte * payloads = nullptr;
 };
 
-struct LoginAuthenticateResponse : public SingleBooleanMessage<MessageType::LOGIN_AUTHENTICATE_RESPONSE> {
-	bool & success = SingleBooleanMessage::value;
+/**
+ * Collects encoded messages and emits them as a single BATCH frame. add() returns false once
+ * the frame would no longer fit, at which point the caller should send and clear() the batch.
+ * A batch holding one message is emitted as that message's own frame, since wrapping it would
+ * only add overhead.
+ */
+class BatchBuilder : public EncodableMessage<BatchBuilder> {
+	std::vector<BufferByte> frames{}; // Complete frames, headers included, in order
+	size_t count = 0;
+	size_t tableLength = 0;
+	size_t payloadLength = 0;
+	
+	public:
+	BatchBuilder() = default;
+	
+	template<typename Encodable>
+	bool add(const Encodable & message) {
+		const auto length = message.encodedSize();
+		if (!fits(length))
+			return false;
+		const auto offset = frames.size();
+		frames.resize(offset + length);
+		message.encodeInto(frames.data() + offset, length);
+		account(length);
+		return true;
+	}
+	
+	/// Adds an already encoded frame, such as a cached response
+	bool add(const Buffer & frame);
+	
+	[[nodiscard]] inline bool empty() const noexcept { return count == 0; }
+	[[nodiscard]] inline size_t size() const noexcept { return count; }
+	void clear() noexcept;
+	
+	[[nodiscard]] size_t encodedSize() const noexcept;
+	using EncodableMessage::encodeInto;
+	size_t encodeInto(BufferByte * dst, size_t capacity) const noexcept;
 	
-	LoginAuthenticateResponse() : SingleBooleanMessage() {}
-	explicit LoginAuthenticateResponse(bool success) : SingleBooleanMessage() { SingleBooleanMessage::value = success; }
-	~LoginAuthenticateResponse() override = default;
+	private:
+	[[nodiscard]] bool fits(size_t frameLength) const noexcept;
+	void account(size_t frameLength) noexcept;
 };
@@ -2,34 +2,70 @@
 #define PASSWDMGR_H
 
 #include <string>
+#include <vector>
 #include <stdexcept>
-#include "FileDesc.h"
+#include <cstdint>
+#include <sys/types.h>
+#include "exceptions.h"
 
 /****************************************************************************************
  * PasswdMgr - Manages user authentication through a file
  *
+ *    The password file is a fixed-width binary table: a Header followed by Records sorted
+ *    by username. It is memory-mapped, so a lookup is a binary search over the mapping with
+ *    no parsing, and a password change overwrites its record in place. Writers hold an
+ *    exclusive flock on the file from finding their record until the write is done.
+ *
  ****************************************************************************************/
 
 class PasswdMgr {
    public:
+      static const size_t hashlen = 32;
+      static const size_t saltlen = 16;
+      static const size_t namelen = 64;   // Including the zero padding, so at most 63 characters
+
       PasswdMgr(const char *pwd_file);
       ~PasswdMgr();
 
       bool checkUser(const char *name);
       bool checkPasswd(const char *name, const char *passwd);
       bool changePasswd(const char *name, const char *newpassd);
-   
+
       void addUser(const char *name, const char *passwd);
 
-      void hashArgon2(std::vector<uint8_t> &ret_hash, std::vector<uint8_t> &ret_salt, const char *passwd, 
+      void hashArgon2(std::vector<uint8_t> &ret_hash, std::vector<uint8_t> &ret_salt, const char *passwd,
                                                                                  std::vector<uint8_t> *in_salt = NULL);
 
    private:
+      // On-disk layout, in host byte order. Names are lowercased and zero-padded, so memcmp of
+      // the name fields sorts the same way as the names themselves.
+      struct Header {
+         char magic[4];
+         uint32_t recordsize;
+         uint64_t count;
+      };
+
+      struct Record {
+         char name[namelen];
+         uint8_t hash[hashlen];
+         uint8_t salt[saltlen];
+      };
+
       bool findUser(const char *name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt);
-      bool readUser(FileFD &pwfile, std::string &name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt);
-      int writeUser(FileFD &pwfile, std::string &name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt);
+      const Record *findRecord(const char *name);
+      bool makeKey(const char *name, char (&key)[namelen]);
+      int lockFile(int flags);
+      void mapFile();
+      void unmapFile();
 
       std::string _pwd_file;
+
+      // Current mapping and the file it was taken from; remapped when the file is replaced or grows
+      const char *_map = NULL;
+      size_t _maplen = 0;
+      dev_t _dev = 0;
+      ino_t _ino = 0;
+      off_t _size = -1;
 };
 
 #endif
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Selector.h>
+
+#include <array>
+#include <cassert>
+#include <memory>
+
+/**
+ * Replies that never change, encoded once up front. Sending one queues a view of the cached
+ * frame, so a request costs no formatting, encoding or copying of the reply. `Key` is an enum
+ * ending in COUNT.
+ */
+template<typename Key>
+class ResponseCache {
+	std::array<std::shared_ptr<const Buffer>, static_cast<size_t>(Key::COUNT)> responses{};
+	
+	public:
+	ResponseCache() = default;
+	~ResponseCache() = default;
+	
+	template<typename Encodable>
+	void set(Key key, const Encodable & message) {
+		responses[static_cast<size_t>(key)] = message.encode();
+	}
+	
+	[[nodiscard]] inline const Buffer & get(Key key) const noexcept {
+		assert(responses[static_cast<size_t>(key)] != nullptr);
+		return *responses[static_cast<size_t>(key)];
+	}
+};
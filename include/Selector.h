@@ -21,19 +21,42 @@
 
 using BufferByte = int8_t;
 
+/**
+ * A view over a block of storage. Copies share the storage but track their own offset, so one
+ * immutable buffer can be queued on any number of connections without copying its bytes.
+ */
 class Buffer {
-	std::unique_ptr<BufferByte[]> mData = nullptr;
+	static std::atomic<size_t> allocated; // Bytes of storage allocated by Buffers in the process
+	
+	std::shared_ptr<BufferByte[]> mData = nullptr;
 	size_t mLength = 0;
 	size_t mOffset = 0;
+	size_t mCapacity = 0;
+	bool mAppendable = false; // Only buffers reserved by a DynamicBuffer may be written past mLength
 	
 	public:
+	/// Creates an empty buffer with room for `capacity` bytes to be appended
+	explicit Buffer(size_t capacity);
 	explicit Buffer(const std::string& str);
 	Buffer(const void *data, size_t length);
 	Buffer(std::unique_ptr<BufferByte[]> data, size_t length);
+	Buffer(const Buffer & b);
+	Buffer& operator=(const Buffer &) = delete;
+	Buffer(Buffer && b) noexcept;
+	Buffer& operator=(Buffer && b) noexcept;
 	~Buffer() = default;
 	
 	[[nodiscard]] inline const BufferByte * data() const { assert(mOffset <= mLength); return mData.get() + mOffset; }
 	[[nodiscard]] inline size_t length() const { assert(mOffset <= mLength); return mLength - mOffset; }
+	/// Number of bytes of storage behind this buffer, regardless of how much has been consumed
+	[[nodiscard]] inline size_t capacity() const noexcept { return mCapacity; }
+	/// Storage this buffer holds on its own: all of it, or only the unsent bytes if other buffers
+	/// share it, as when a cached response is queued on many connections
+	[[nodiscard]] inline size_t ownedBytes() const noexcept { return mData.use_count() > 1 ? length() : mCapacity; }
+	[[nodiscard]] static inline size_t allocatedBytes() noexcept { return allocated.load(std::memory_order_relaxed); }
+	[[nodiscard]] inline size_t available() const noexcept { return mAppendable ? mCapacity - mLength : 0; }
+	[[nodiscard]] inline BufferByte * tail() noexcept { assert(mAppendable); return mData.get() + mLength; }
+	inline void commit(size_t length) noexcept { assert(length <= available()); mLength += length; }
 	
 	ssize_t advance(size_t offset) {
 		const auto currentLength = mLength;
@@ -56,28 +79,52 @@ class Buffer {
 	inline BufferByte operator[](size_t i) const noexcept {
 		return get(i);
 	}
+	
+	private:
+	static std::shared_ptr<BufferByte[]> allocate(size_t capacity);
+	static std::shared_ptr<BufferByte[]> adopt(std::unique_ptr<BufferByte[]> data, size_t capacity);
 };
 
 class DynamicBuffer {
-	std::list<std::shared_ptr<Buffer>> buffers{};
+	static constexpr size_t CHUNK_SIZE = 4096;
+	
+	std::list<Buffer> buffers{};
+	size_t mLength = 0;    // Unconsumed bytes across all buffers
+	size_t mStorage = 0;   // Capacity of all buffers
+	size_t * total = nullptr;  // Kept up to date with mStorage; not moved with the contents
 	
 	public:
 	DynamicBuffer() = default;
-	~DynamicBuffer() = default;
+	DynamicBuffer(const DynamicBuffer &) = delete;
+	DynamicBuffer& operator=(const DynamicBuffer &) = delete;
+	DynamicBuffer(DynamicBuffer && b) noexcept;
+	DynamicBuffer& operator=(DynamicBuffer && b) noexcept;
+	~DynamicBuffer() {
+		if (total != nullptr)
+			*total -= mStorage;
+	}
 	
-	[[nodiscard]] std::shared_ptr<Buffer> getNextBuffer() const { assert(!buffers.empty()); return buffers.front(); }
+	[[nodiscard]] const Buffer & getNextBuffer() const { assert(!buffers.empty()); return buffers.front(); }
 	void advanceBuffer(size_t count);
 	void addBuffer(const std::shared_ptr<Buffer>&);
+	void addBuffer(const Buffer&);
+	void addBuffer(Buffer&&);
 	void addBuffer(DynamicBuffer&);
 	[[nodiscard]] inline bool isDataReady() const noexcept { return !buffers.empty(); }
 	
-	[[nodiscard]] size_t length() const noexcept {
-		size_t len = 0;
-		for (const auto& buf : buffers) {
-			assert(buf->length() > 0); // Should have been cleaned up
-			len += buf->length();
-		}
-		return len;
+	[[nodiscard]] inline size_t length() const noexcept { return mLength; }
+	/// Bytes of storage the buffers hold on their own; see Buffer::ownedBytes
+	[[nodiscard]] size_t allocated() const noexcept;
+	/// Bytes of storage behind the buffers, shared or not. Never less than allocated(), and kept
+	/// as the buffers change rather than counted when asked.
+	[[nodiscard]] inline size_t storage() const noexcept { return mStorage; }
+	/// Adds storage() to `*total`, and keeps it updated until the buffer is destroyed
+	inline void trackStorage(size_t * total) noexcept {
+		if (this->total != nullptr)
+			*this->total -= mStorage;
+		this->total = total;
+		if (total != nullptr)
+			*total += mStorage;
 	}
 	
 	BufferByte operator[](size_t i) const noexcept {
@@ -85,27 +132,51 @@ class DynamicBuffer {
 		
 		size_t len = 0;
 		for (const auto& buf : buffers) {
-			assert(buf->length() > 0); // Should have been cleaned up
+			assert(buf.length() > 0); // Should have been cleaned up
 			auto prevLen = len;
-			len += buf->length();
+			len += buf.length();
 			if (len > i)
-				return buf->get(i - prevLen);
+				return buf.get(i - prevLen);
 		}
 		assert(false); // Ran off end of buffer
 		return 0xAF;   // Odd return value that should indicate we screwed up
 	}
 	
-	bool peekNext(void * dst, size_t length);
+	bool peekNext(void * dst, size_t length) const;
 	bool getNext(void * dst, size_t length);
 	Buffer getNext(size_t length);
+	/// Returns the first `length` bytes as one contiguous range, only copying if they span buffers
+	const BufferByte * contiguous(size_t length);
+	/// Returns room for `length` bytes at the end of the last buffer, allocating a new one if it
+	/// is full. Whatever was written becomes part of this buffer once commit() is called.
+	BufferByte * reserve(size_t length);
+	void commit(size_t length);
+	
+	private:
+	void popBuffer();
+	
+	inline void addStorage(size_t bytes) noexcept {
+		mStorage += bytes;
+		if (total != nullptr)
+			*total += bytes;
+	}
+	
+	inline void removeStorage(size_t bytes) noexcept {
+		mStorage -= bytes;
+		if (total != nullptr)
+			*total -= bytes;
+	}
 };
 
 template<typename T>
 class FD {
+	static constexpr size_t PRODUCE_WATERMARK = 64u * 1024u;
+	
 	int fd = -1;
 	std::function<std::shared_ptr<Buffer>(int)> readHandler = &FD::defaultRead;
 	std::function<ssize_t(int, const BufferByte *, size_t)> writeHandler = &FD::defaultWrite;
 	std::function<void(int)> closeHandler = &FD::defaultClose;
+	std::function<bool(DynamicBuffer&)> producer = nullptr;
 	DynamicBuffer readBuffer  = {};
 	DynamicBuffer writeBuffer = {};
 	std::shared_ptr<T> data   = nullptr;
@@ -123,6 +194,7 @@ class FD {
 					 readHandler(std::move(f.readHandler)),
 					 writeHandler(std::move(f.writeHandler)),
 					 closeHandler(std::move(f.closeHandler)),
+					 producer(std::move(f.producer)),
 					 readBuffer(std::move(f.readBuffer)),
 					 writeBuffer(std::move(f.writeBuffer)),
 					 data(std::move(f.data)) {
@@ -135,10 +207,12 @@ class FD {
 		readHandler = std::move(f.readHandler);
 		writeHandler = std::move(f.writeHandler);
 		closeHandler = std::move(f.closeHandler);
+		producer = std::move(f.producer);
 		readBuffer = std::move(f.readBuffer);
 		writeBuffer = std::move(f.writeBuffer);
 		data = std::move(f.data);
 		f.fd = -1;
+		return *this;
 	}
 	~FD() {
 		if (fd >= 0)
@@ -156,8 +230,8 @@ class FD {
 		do {
 			if (!writeBuffer.isDataReady())
 				return;
-			auto buffer = writeBuffer.getNextBuffer();
-			written = writeHandler(fd, buffer->data(), buffer->length());
+			const auto & buffer = writeBuffer.getNextBuffer();
+			written = writeHandler(fd, buffer.data(), buffer.length());
 			if (written > 0)
 				writeBuffer.advanceBuffer(written);
 			else if (written < 0 && !(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
@@ -167,9 +241,22 @@ class FD {
 		} while (written > 0);
 	}
 	
+	/// Replaces any current producer. See Selector::streamToFD.
+	inline void setProducer(std::function<bool(DynamicBuffer&)> producer) { this->producer = std::move(producer); }
+	[[nodiscard]] inline bool isProducing() const noexcept { return producer != nullptr; }
+	
+	/// Tops the write buffer up to PRODUCE_WATERMARK bytes, dropping the producer once it is done
+	void produce() {
+		while (producer != nullptr && writeBuffer.length() < PRODUCE_WATERMARK) {
+			if (!producer(writeBuffer))
+				producer = nullptr;
+		}
+	}
+	
 	[[nodiscard]] inline DynamicBuffer& getReadBuffer() noexcept { return *(&readBuffer); }
 	[[nodiscard]] inline DynamicBuffer& getWriteBuffer() noexcept { return *(&writeBuffer); }
 	[[nodiscard]] inline std::shared_ptr<T> getData() const noexcept { return data; }
+	[[nodiscard]] inline size_t memoryUsage() const noexcept { return readBuffer.allocated() + writeBuffer.allocated(); }
 	
 	private:
 	static std::shared_ptr<Buffer> defaultRead(int fd) {
@@ -203,18 +290,36 @@ enum class SelectLoopTermination {
 	SOCKET_ERROR
 };
 
+struct SelectorConnectionMemory {
+	int fd;
+	size_t readBytes;
+	size_t writeBytes;
+};
+
+struct SelectorMemoryStats {
+	size_t total = 0;     // Bytes held by the read/write buffers of every FD in the selector
+	size_t limit = 0;     // Configured cap, 0 if unlimited
+	size_t process = 0;   // Bytes held by every Buffer in the process
+	std::vector<SelectorConnectionMemory> connections{};
+};
+
 template<typename T>
 using SelectorReadCallback = std::function<void(int, const std::shared_ptr<T>&, DynamicBuffer&)>;
 template<typename T>
 using SelectorCloseCallback = std::function<void(int, const std::shared_ptr<T>&)>;
+template<typename T>
+using SelectorShedCallback = std::function<void(int, const std::shared_ptr<T>&, size_t)>;
 
 template<typename T>
 class Selector {
 	using FDPTR = std::shared_ptr<FD<T>>;
+	size_t storage = 0; // DynamicBuffer::storage of every FD's buffers; declared first to outlive them
 	std::vector<FDPTR> fds;
-	SelectorReadCallback<T> readCallback = [](auto, auto, auto){};
+	SelectorReadCallback<T> readCallback = [](auto, const auto &, auto &){};
 	SelectorCloseCallback<T> closeCallback = [](auto, auto){};
+	SelectorShedCallback<T> shedCallback = [](auto, auto, auto){};
 	std::atomic<bool> running = true;
+	size_t memoryLimit = 0;
 	
 	public:
 	Selector() = default;
@@ -228,9 +333,38 @@ class Selector {
 		this->closeCallback = callback;
 	}
 	
-	inline void addFD(FD<T> && fd) { fds.emplace_back(std::make_shared<FD<T>>(std::move(fd))); }
+	inline void setShedCallback(const SelectorShedCallback<T> & callback) {
+		this->shedCallback = callback;
+	}
+	
+	/// Caps the bytes held by all read/write buffers. Once exceeded, the largest consumers are
+	/// disconnected until usage is back under the limit. 0 disables the cap.
+	inline void setMemoryLimit(size_t limit) noexcept {
+		this->memoryLimit = limit;
+	}
+	
+	[[nodiscard]] size_t memoryUsage() const noexcept {
+		size_t total = 0;
+		for (const auto & fd : fds)
+			total += fd->memoryUsage();
+		return total;
+	}
+	
+	[[nodiscard]] SelectorMemoryStats getMemoryStats() const {
+		SelectorMemoryStats stats{};
+		stats.limit = memoryLimit;
+		stats.process = Buffer::allocatedBytes();
+		stats.connections.reserve(fds.size());
+		for (const auto & fd : fds) {
+			auto & connection = stats.connections.emplace_back(SelectorConnectionMemory{fd->getFD(), fd->getReadBuffer().allocated(), fd->getWriteBuffer().allocated()});
+			stats.total += connection.readBytes + connection.writeBytes;
+		}
+		return stats;
+	}
+	
+	inline void addFD(FD<T> && fd) { track(fds.emplace_back(std::make_shared<FD<T>>(std::move(fd)))); }
 	/// Creates a generic FD with the default read/write/close
-	inline void addFD(int fd) { fds.emplace_back(std::make_shared<FD<T>>(fd, nullptr)); }
+	inline void addFD(int fd) { track(fds.emplace_back(std::make_shared<FD<T>>(fd, nullptr))); }
 	
 	void writeToFD(int fd, std::shared_ptr<Buffer> buffer) {
 		runIfFDFound(fd, [&buffer](FDPTR it) {
@@ -238,12 +372,50 @@ class Selector {
 		});
 	}
 	
+	/// Queues a view of `buffer`; its storage is shared rather than copied
+	void writeToFD(int fd, const Buffer & buffer) {
+		runIfFDFound(fd, [&buffer](FDPTR it) {
+			it->getWriteBuffer().addBuffer(buffer);
+		});
+	}
+	
 	void writeToFD(int fd, DynamicBuffer & buffer) {
 		runIfFDFound(fd, [&buffer](FDPTR it) {
 			it->getWriteBuffer().addBuffer(buffer);
 		});
 	}
 	
+	/// Sends output that is generated as the socket drains, rather than all up front. `producer`
+	/// appends to the write buffer and returns false when it has nothing left; it is called
+	/// whenever fewer than FD::PRODUCE_WATERMARK bytes are waiting to be written.
+	void streamToFD(int fd, std::function<bool(DynamicBuffer&)> producer) {
+		runIfFDFound(fd, [&producer](FDPTR it) {
+			it->setProducer(std::move(producer));
+			it->produce();
+		});
+	}
+	
+	/// Serializes straight into the FD's write buffer through `message.encodeInto(DynamicBuffer&)`
+	template<typename Encodable>
+	void encodeToFD(int fd, const Encodable & message) {
+		runIfFDFound(fd, [&message](FDPTR it) {
+			message.encodeInto(it->getWriteBuffer());
+		});
+	}
+	
+	/// Runs the read callback again over what is already buffered for fd, such as input a handler
+	/// left there to deal with later. The FD is removed if the callback throws, as for a read.
+	void redeliver(int fd) {
+		try {
+			runIfFDFound(fd, [this, fd](FDPTR it) {
+				if (it->getReadBuffer().isDataReady())
+					readCallback(fd, it->getData(), it->getReadBuffer());
+			});
+		} catch (const socket_error & se) {
+			removeFD(fd);
+		}
+	}
+	
 	void removeFD(int fd) {
 		const auto it = std::find_if(std::cbegin(fds), std::cend(fds), [fd](const auto & a) { return a->getFD() == fd; });
 		if (it != std::cend(fds)) {
@@ -276,6 +448,7 @@ class Selector {
 			for (auto & fd : possibleFDs) {
 				handleFileDescriptorReady(fd, fdcollection);
 			}
+			enforceMemoryLimit();
 			fdcollection = getFDCollection();
 			reinitializePossibleFDs(possibleFDs);
 		}
@@ -298,6 +471,7 @@ class Selector {
 			for (auto & fd : possibleFDs) {
 				handleFileDescriptorReady(fd, fdcollection);
 			}
+			enforceMemoryLimit();
 			fdcollection = getFDCollection();
 			reinitializePossibleFDs(possibleFDs);
 		}
@@ -371,6 +545,7 @@ class Selector {
 			} else if (FD_ISSET(fd, &fdcollection.write)) {
 				runIfFDFound(fd, [](FDPTR it) {
 					it->doWrite();
+					it->produce();
 				});
 			} else if (FD_ISSET(fd, &fdcollection.except)) {
 				removeFD(fd);
@@ -380,6 +555,35 @@ class Selector {
 		}
 	}
 	
+	void track(const FDPTR & fd) noexcept {
+		fd->getReadBuffer().trackStorage(&storage);
+		fd->getWriteBuffer().trackStorage(&storage);
+	}
+	
+	/// Runs after every select, so only counts usage when the storage behind the buffers, which
+	/// can't be less, is over the limit. Then each FD is counted once per connection shed.
+	void enforceMemoryLimit() {
+		if (memoryLimit == 0 || storage <= memoryLimit)
+			return;
+		while (true) {
+			size_t usage = 0;
+			size_t largestUsage = 0;
+			FDPTR largest = nullptr;
+			for (const auto & fd : fds) {
+				const auto fdUsage = fd->memoryUsage();
+				usage += fdUsage;
+				if (fdUsage > largestUsage) {
+					largestUsage = fdUsage;
+					largest = fd;
+				}
+			}
+			if (usage <= memoryLimit || largest == nullptr)
+				return;
+			shedCallback(largest->getFD(), largest->getData(), largestUsage);
+			removeFD(largest->getFD()); // Storage it shared may now be held by others alone
+		}
+	}
+	
 	inline FDPTR findFD(int fd) {
 		auto it = std::find_if(std::cbegin(fds), std::cend(fds), [fd](const auto & a) { return a->getFD() == fd; });
 		if (it == std::cend(fds))
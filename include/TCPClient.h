@@ -1,9 +1,12 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include <Client.h>
 #include <Selector.h>
 #include <NetworkMessage.h>
+#include <MessageDispatcher.h>
+#include <Compression.h>
 
 class TCPClient : public Client {
 	enum ClientInputState {
@@ -16,10 +19,19 @@ class TCPClient : public Client {
 	
 	using StoredDataType = void;
 	using StoredDataPointer = const std::shared_ptr<StoredDataType>&;
+	using Dispatcher = MessageDispatcher<TCPClient, StoredDataType>;
 	Selector<StoredDataType> selector;
 	int fd;
 	ClientInputState clientInputState = ClientInputState::NONE;
 	std::string passwordTemporaryStorage = "";
+	BatchBuilder pendingCommands;  // Commands typed since the last flush, sent as one BATCH if the server can take it
+	uint8_t protocolVersion = 0;   // Agreed with the server in HELLO
+	uint32_t capabilities = 0;
+	std::string decompressed{};   // Reused between compressed messages
+	uint64_t nextRequestId = 1;
+	std::unordered_map<uint64_t, MessageType> pendingRequests{}; // Request ID to the reply that completes it
+	std::optional<uint64_t> currentRequest; // ID the message being handled was tagged with
+	std::unordered_map<uint64_t, MessageType> streams{}; // Content type of each open stream
 	
 	public:
 	TCPClient();
@@ -31,11 +43,26 @@ class TCPClient : public Client {
 	void closeConn() override;
 	
 	private:
+	static const Dispatcher & dispatcher();
+	
 	void onRead(int fd, const std::shared_ptr<void>& data, DynamicBuffer & buffer);
 	
+	template<typename Encodable>
+	void send(const Encodable & message);
+	template<typename Encodable>
+	void queueCommand(const Encodable & message);
+	void flushCommands();
+	void finishRequest(MessageType reply);
+	void readUserInput(DynamicBuffer & buffer);
 	void handleUserInput(std::string input);
-	void onReadLoginSetUsernameResponse(int fd, StoredDataPointer data, LoginSetUsernameResponse msg);
-	void onReadLoginSetPasswordResponse(int fd, StoredDataPointer data, LoginSetPasswordResponse msg);
-	void onReadLoginAuthenticateResponse(int fd, StoredDataPointer data, LoginAuthenticateResponse msg);
-	static void onReadDisplayMessage(int fd, StoredDataPointer data, DisplayMessage msg);
+	void onReadUnknown(int fd, StoredDataPointer data, MessageType type);
+	void onReadLoginSetUsernameResponse(int fd, StoredDataPointer data, const LoginSetUsernameResponse & msg);
+	void onReadLoginSetPasswordResponse(int fd, StoredDataPointer data, const LoginSetPasswordResponse & msg);
+	void onReadLoginAuthenticateResponse(int fd, StoredDataPointer data, const LoginAuthenticateResponse & msg);
+	void onReadHello(int fd, StoredDataPointer data, const HelloMessage & msg);
+	void onReadDisplayMessage(int fd, StoredDataPointer data, const DisplayMessage & msg);
+	void onReadStreamBegin(int fd, StoredDataPointer data, const StreamBegin & msg);
+	void onReadStreamChunk(int fd, StoredDataPointer data, const StreamChunk & msg);
+	void onReadStreamEnd(int fd, StoredDataPointer data, const StreamEnd & msg);
+	void onReadBatch(int fd, StoredDataPointer data, const BatchMessage & msg);
 };
@@ -3,7 +3,14 @@
 #include <Server.h>
 #include <Selector.h>
 #include <NetworkMessage.h>
+#include <MessageDispatcher.h>
+#include <ResponseCache.h>
+#include <Compression.h>
+#include <WorkerPool.h>
+#include <AsyncLogger.h>
 #include <Database.h>
+#include <Whitelist.h>
+#include <FileWatcher.h>
 #include <ctime>
 #include <utility>
 
@@ -14,16 +21,47 @@ class TCPServer : public Server {
 		int passwordAttempts  = 0;
 		bool usernameVerified = false;
 		bool passwordVerified = false;
+		uint8_t protocolVersion = 0; // Agreed in HELLO; 0 until the client negotiates
+		uint32_t capabilities   = 0;
+		bool hashing = false; // A password is being hashed for this connection
+		bool waiting = false; // And its reply has no request ID, so what follows waits for it
+	};
+	
+	enum class Response {
+		HELLO,
+		GENERIC_1,
+		GENERIC_2,
+		GENERIC_3,
+		GENERIC_4,
+		GENERIC_5,
+		MENU,
+		GREETING,
+		COUNT
 	};
 	
 	using StoredDataType = User;
 	using StoredDataPointer = const std::shared_ptr<StoredDataType>&;
+	using Dispatcher = MessageDispatcher<TCPServer, StoredDataType>;
 	Selector<StoredDataType> selector;
-	Database<1, ','>  whitelist {"whitelist"};
-	Database<3, ','>  passwd    {"passwd"};
-	Database<2, '\t'> logfile   {"server.log"};
+	Whitelist              whitelist {"whitelist"};
+	CachedDatabase<3, ','> passwd    {"passwd"};
+	AsyncLogger            logger    {"server.log", LOG_ROTATION};
+	FileWatcher            watcher;                // Tells whitelist and passwd when their files change
+	ResponseCache<Response> responses;
+	std::array<ResponseCache<Response>, static_cast<size_t>(Compression::Codec::COUNT)> compressedResponses;
+	BatchBuilder replyBatch;  // Replies to the BATCH currently being handled
+	int replyBatchFD = -1;
+	std::optional<uint64_t> currentRequest;  // ID of the request being handled, which replies carry
+	WorkerPool reloads {1};                   // Rebuilds what watcher reports changed, off the loop
+	WorkerPool workers {HASH_WORKERS};        // Last, so it stops before what its jobs use
 	
 	public:
+	static constexpr size_t DEFAULT_MEMORY_LIMIT = 64u * 1024u * 1024u;
+	static constexpr size_t HASH_WORKERS = 2; // Each Argon2 hash holds 64 MiB while it runs
+	static constexpr int MAX_PASSWORD_ATTEMPTS = 3;
+	// A new server.log segment at 64 MiB or daily, keeping two weeks' worth
+	static constexpr AsyncLogger::Rotation LOG_ROTATION = {64u * 1024u * 1024u, 24 * 60 * 60, 14};
+	
 	TCPServer();
 	~TCPServer() override = default;
 	
@@ -31,22 +69,45 @@ class TCPServer : public Server {
 	void listenSvr() override;
 	void shutdown() final;
 	
+	void setMemoryLimit(size_t limit);
+	[[nodiscard]] SelectorMemoryStats getMemoryStats() const;
+	void logMemoryStats();
+	
 	private:
+	static const Dispatcher & dispatcher();
 	static std::string createGreeting();
 	static std::string createMenu();
-	void log(std::string data);
+	void log(std::string_view data);
+	void setResponse(Response key, std::string_view text);
+	void watchFiles();
+	[[nodiscard]] const Buffer & response(StoredDataPointer data, Response key) const;
+	
+	template<typename Encodable>
+	void reply(int fd, const Encodable & message);
+	void reply(int fd, const Buffer & frame);
+	template<typename Encodable>
+	void queueReply(int fd, const Encodable & message);
+	void flushReplyBatch();
+	template<typename Completion>
+	void hashAsync(int fd, StoredDataPointer data, std::string password, std::string salt, Completion && completion);
+	[[nodiscard]] const char * hashRefusal(int fd, StoredDataPointer data) const;
 	
 	void onRead(int fd, StoredDataPointer data, DynamicBuffer & buffer);
 	void onClose(int fd, StoredDataPointer data);
+	void onShed(int fd, StoredDataPointer data, size_t bytes);
 	
-	void onReadHelloRequest(int fd, StoredDataPointer data, HelloMessage msg);
-	void onReadGeneric1Request(int fd, StoredDataPointer data, Generic1Message msg);
-	void onReadGeneric2Request(int fd, StoredDataPointer data, Generic2Message msg);
-	void onReadGeneric3Request(int fd, StoredDataPointer data, Generic3Message msg);
-	void onReadGeneric4Request(int fd, StoredDataPointer data, Generic4Message msg);
-	void onReadGeneric5Request(int fd, StoredDataPointer data, Generic5Message msg);
-	void onReadMenuRequest(int fd, StoredDataPointer data, MenuMessage msg);
-	void onReadLoginSetUsername(int fd, StoredDataPointer data, LoginSetUsername msg);
-	void onReadLoginSetPassword(int fd, StoredDataPointer data, LoginSetPassword msg);
-	void onReadLoginAuthenticate(int fd, StoredDataPointer data, LoginAuthenticate msg);
+	void onReadUnknown(int fd, StoredDataPointer data, MessageType type);
+	void onReadHelloRequest(int fd, StoredDataPointer data, const HelloMessage & msg);
+	void onReadGeneric1Request(int fd, StoredDataPointer data, const Generic1Message & msg);
+	void onReadGeneric2Request(int fd, StoredDataPointer data, const Generic2Message & msg);
+	void onReadGeneric3Request(int fd, StoredDataPointer data, const Generic3Message & msg);
+	void onReadGeneric4Request(int fd, StoredDataPointer data, const Generic4Message & msg);
+	void onReadGeneric5Request(int fd, StoredDataPointer data, const Generic5Message & msg);
+	void onReadMenuRequest(int fd, StoredDataPointer data, const MenuMessage & msg);
+	void onReadLoginSetUsername(int fd, StoredDataPointer data, const LoginSetUsername & msg);
+	void onReadLoginSetPassword(int fd, StoredDataPointer data, const LoginSetPassword & msg);
+	void onReadLoginAuthenticate(int fd, StoredDataPointer data, const LoginAuthenticate & msg);
+	void finishLoginSetPassword(int fd, StoredDataPointer data, const std::string & hashed);
+	void finishLoginAuthenticate(int fd, StoredDataPointer data, bool verified);
+	void onReadBatch(int fd, StoredDataPointer data, const BatchMessage & msg);
 };
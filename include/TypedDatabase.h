@@ -0,0 +1,309 @@
+#pragma once
+
+#include <Database.h>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+
+/*
+ * Column codecs convert between a column's text in the file and its type in the record.
+ * parse() returns false if the text isn't a valid value, and the row is skipped like a row
+ * with the wrong number of columns. Specialise ColumnCodec to store other types.
+ */
+template<typename T, typename Enable = void>
+struct ColumnCodec;
+
+template<>
+struct ColumnCodec<std::string> {
+	static inline bool parse(std::string_view text, std::string & value) {
+		value.assign(text.data(), text.length());
+		return true;
+	}
+	
+	static inline std::string format(const std::string & value) { return value; }
+};
+
+/// Integers in decimal
+template<typename T>
+struct ColumnCodec<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+	static inline bool parse(std::string_view text, T & value) {
+		const auto end = text.data() + text.length();
+		const auto result = std::from_chars(text.data(), end, value);
+		return result.ec == std::errc() && result.ptr == end;
+	}
+	
+	static inline std::string format(T value) { return std::to_string(value); }
+};
+
+/// 1 or 0
+template<>
+struct ColumnCodec<bool> {
+	static inline bool parse(std::string_view text, bool & value) {
+		if (text != "0" && text != "1")
+			return false;
+		value = text == "1";
+		return true;
+	}
+	
+	static inline std::string format(bool value) { return value ? "1" : "0"; }
+};
+
+/// A fixed number of raw bytes, such as a salt or a hash
+template<size_t N>
+using FixedBytes = std::array<uint8_t, N>;
+
+/// Padded base64 of exactly N bytes, as Security encodes salts and hashes. Any other length,
+/// stray characters or bits set under the padding don't parse.
+template<size_t N>
+struct ColumnCodec<FixedBytes<N>> {
+	static constexpr size_t LENGTH = (N + 2) / 3 * 4;
+	
+	static inline bool parse(std::string_view text, FixedBytes<N> & value) {
+		if (text.length() != LENGTH)
+			return false;
+		for (size_t i = 0, j = 0; i < N; i += 3, j += 4) {
+			uint32_t group = 0;
+			for (size_t k = 0; k < 4; k++) {
+				// Digits past the last byte are padding
+				const bool padding = k > 1 && i + k - 1 >= N;
+				const auto bits = digit(text[j + k]);
+				if (padding ? text[j + k] != '=' : bits < 0)
+					return false;
+				group = group << 6u | (padding ? 0u : static_cast<uint32_t>(bits));
+			}
+			const size_t unused = i + 3 > N ? (i + 3 - N) * 8 : 0;
+			if ((group & ((1u << unused) - 1)) != 0)
+				return false;
+			value[i] = static_cast<uint8_t>(group >> 16u);
+			if (i + 1 < N)
+				value[i + 1] = static_cast<uint8_t>(group >> 8u);
+			if (i + 2 < N)
+				value[i + 2] = static_cast<uint8_t>(group);
+		}
+		return true;
+	}
+	
+	static inline std::string format(const FixedBytes<N> & value) {
+		constexpr char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		std::string text(LENGTH, '=');
+		for (size_t i = 0, j = 0; i < N; i += 3, j += 4) {
+			const uint32_t group = static_cast<uint32_t>(value[i]) << 16u
+					| (i + 1 < N ? static_cast<uint32_t>(value[i + 1]) << 8u : 0u)
+					| (i + 2 < N ? static_cast<uint32_t>(value[i + 2]) : 0u);
+			text[j] = ALPHABET[group >> 18u & 63u];
+			text[j + 1] = ALPHABET[group >> 12u & 63u];
+			if (i + 1 < N)
+				text[j + 2] = ALPHABET[group >> 6u & 63u];
+			if (i + 2 < N)
+				text[j + 3] = ALPHABET[group & 63u];
+		}
+		return text;
+	}
+	
+	private:
+	static constexpr int digit(char c) noexcept {
+		if (c >= 'A' && c <= 'Z')
+			return c - 'A';
+		if (c >= 'a' && c <= 'z')
+			return c - 'a' + 26;
+		if (c >= '0' && c <= '9')
+			return c - '0' + 52;
+		return c == '+' ? 62 : c == '/' ? 63 : -1;
+	}
+};
+
+template<typename T> struct ColumnMember;
+template<typename Class, typename T> struct ColumnMember<T Class::*> {
+	using Record = Class;
+	using Type = T;
+};
+
+/// One column of a table: the record member it is read into, and how it is written
+template<auto MEMBER, typename ColumnCodecType = ColumnCodec<typename ColumnMember<decltype(MEMBER)>::Type>>
+struct Column {
+	static constexpr auto POINTER = MEMBER;
+	using Record = typename ColumnMember<decltype(MEMBER)>::Record;
+	using Codec = ColumnCodecType;
+};
+
+/// The columns of a table, in file order, and the record each row is read into
+template<typename FirstColumn, typename... Columns>
+struct TableSchema {
+	using Record = typename FirstColumn::Record;
+	static_assert((std::is_same_v<typename Columns::Record, Record> && ...), "Columns must belong to the same record");
+	
+	static constexpr int COUNT = 1 + sizeof...(Columns);
+	using Row = std::array<std::string, COUNT>;
+	using RowView = std::array<std::string_view, COUNT>;
+	
+	static bool parse(const RowView & row, Record & record) {
+		return parse(row, record, std::index_sequence_for<FirstColumn, Columns...>{});
+	}
+	
+	static Row format(const Record & record) {
+		return format(record, std::index_sequence_for<FirstColumn, Columns...>{});
+	}
+	
+	private:
+	template<size_t... I>
+	static bool parse(const RowView & row, Record & record, std::index_sequence<I...>) {
+		return (std::tuple_element_t<I, std::tuple<FirstColumn, Columns...>>::Codec::parse(row[I],
+				record.*std::tuple_element_t<I, std::tuple<FirstColumn, Columns...>>::POINTER) && ...);
+	}
+	
+	template<size_t... I>
+	static Row format(const Record & record, std::index_sequence<I...>) {
+		return {std::tuple_element_t<I, std::tuple<FirstColumn, Columns...>>::Codec::format(
+				record.*std::tuple_element_t<I, std::tuple<FirstColumn, Columns...>>::POINTER)...};
+	}
+};
+
+/// A hash index on one column, from each value to the first row holding it
+template<auto MEMBER>
+struct Index {
+	static constexpr auto POINTER = MEMBER;
+	using Key = typename ColumnMember<decltype(MEMBER)>::Type;
+	std::unordered_map<Key, size_t> rows{};
+};
+
+/// A predicate matching records whose MEMBER equals `value`; TypedDatabase::find answers it
+/// from an Index when there is one on MEMBER
+template<auto MEMBER>
+struct ColumnEquals {
+	using Record = typename ColumnMember<decltype(MEMBER)>::Record;
+	typename ColumnMember<decltype(MEMBER)>::Type value;
+	
+	inline bool operator()(const Record & record) const { return record.*MEMBER == value; }
+};
+
+template<auto MEMBER, typename T>
+ColumnEquals<MEMBER> where(T && value) {
+	return {typename ColumnMember<decltype(MEMBER)>::Type(std::forward<T>(value))};
+}
+
+/**
+ * A Database of typed records. Rows are parsed into Schema::Record once, when the file is
+ * loaded, and kept in memory with a hash Index on each of the Indexes' columns, e.g.
+ *
+ *   TypedDatabase<TableSchema<Column<&Account::name>, Column<&Account::uid>>, ',', Index<&Account::name>>
+ *
+ * find(where<&Account::name>("josh")) is then a single hash lookup. Like CachedDatabase, the
+ * file is only parsed again once a stat() shows it has changed, and lookups make that stat at
+ * most once every StatThrottle::INTERVAL. A watched TypedDatabase skips the stat: whoever
+ * watches the file calls reload() when it changes, which is safe from any thread. Lookups
+ * and writes themselves must come from one thread at a time.
+ */
+template<typename Schema, char delimeter = ',', typename... Indexes>
+class TypedDatabase : public Database<Schema::COUNT, delimeter> {
+	using Base = Database<Schema::COUNT, delimeter>;
+	
+	public:
+	using Record = typename Schema::Record;
+	using FindRecordFunction = const std::function<bool(const Record &)> &;
+	using UpdateRecordFunction = const std::function<Record(const Record &)> &;
+	
+	private:
+	std::vector<Record> records{};   // In file order
+	std::tuple<Indexes...> indexes{};
+	std::atomic<bool> loaded{false};
+	std::atomic<bool> watched{false};   // Lookups trust what is loaded without a stat()
+	StatThrottle stats{};
+	struct stat file{};
+	
+	public:
+	explicit TypedDatabase(std::string filename) : Base(std::move(filename)) {}
+	
+	/// The first record matching op, scanning every record
+	std::optional<Record> find(FindRecordFunction op) {
+		revalidate();
+		for (const auto & record : records) {
+			if (op(record))
+				return record;
+		}
+		return std::nullopt;
+	}
+	
+	/// The first record whose MEMBER equals the predicate's value; a lookup when MEMBER is indexed
+	template<auto MEMBER>
+	std::optional<Record> find(const ColumnEquals<MEMBER> & equals) {
+		if constexpr (indexPosition<MEMBER>() < sizeof...(Indexes)) {
+			revalidate();
+			const auto & index = std::get<indexPosition<MEMBER>()>(indexes).rows;
+			const auto row = index.find(equals.value);
+			if (row == index.end())
+				return std::nullopt;
+			return records[row->second];
+		} else {
+			return find(std::function<bool(const Record &)>(equals));
+		}
+	}
+	
+	/// Appends the record. If nothing else has changed the file since it was loaded, the record
+	/// is added to what is loaded too, rather than the file being parsed again.
+	bool insert(const Record & record) {
+		struct stat before{}, after{};
+		const bool written = Base::insert(Schema::format(record), &before, &after);
+		if (written && loaded && Base::sameFile(file, before)) {
+			add(record);
+			file = after;
+		} else {
+			loaded = false;
+		}
+		return written;
+	}
+	
+	/// Rewrites the file with op applied to each record. Rows that don't parse are kept as they are.
+	bool update(UpdateRecordFunction op) {
+		loaded = false;
+		Record record{};
+		return Base::update([&](const typename Base::DatabaseRow & row) {
+			typename Schema::RowView view{};
+			for (int i = 0; i < Schema::COUNT; i++)
+				view[i] = row[i];
+			return Schema::parse(view, record) ? Schema::format(op(record)) : row;
+		});
+	}
+	
+	/// Parses the file again on the next lookup, whether or not it looks changed
+	void reload() noexcept { loaded = false; }
+	
+	/// Whether something else, such as a FileWatcher, calls reload() when the file changes
+	inline void setWatched(bool watch) noexcept { watched.store(watch, std::memory_order_relaxed); }
+	
+	private:
+	template<auto MEMBER>
+	static constexpr size_t indexPosition() {
+		size_t position = 0;
+		const bool found = (std::is_same_v<Indexes, Index<MEMBER>> || ... || false);
+		((std::is_same_v<Indexes, Index<MEMBER>> ? false : (position++, true)) && ...);
+		return found ? position : sizeof...(Indexes);
+	}
+	
+	void revalidate() {
+		if (loaded && (watched.load(std::memory_order_relaxed) || !stats.due()))
+			return;
+		const auto info = this->statFile();
+		// Marked loaded before parsing, so a reload() that comes in meanwhile isn't lost
+		if (loaded.exchange(true) && Base::sameFile(file, info))
+			return;
+		
+		records.clear();
+		std::apply([](auto &... index) { (index.rows.clear(), ...); }, indexes);
+		Record record{};
+		this->scan([&](const typename Schema::RowView & row) {
+			if (Schema::parse(row, record))
+				add(record);
+			return true;
+		});
+		file = info;
+	}
+	
+	void add(const Record & record) {
+		std::apply([&](auto &... index) {
+			(index.rows.emplace(record.*std::decay_t<decltype(index)>::POINTER, records.size()), ...);
+		}, indexes);
+		records.push_back(record);
+	}
+};
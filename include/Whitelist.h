@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Database.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include <sys/socket.h>
+
+/// A binary trie of address prefixes. Matching walks one node per bit, stopping at the first
+/// prefix that covers the address, so it costs at most one step per bit of the address.
+class AddressTrie {
+	struct Node {
+		std::array<uint32_t, 2> children{}; // 0 if absent; the root is never a child
+		bool covered = false;               // A prefix ends here
+	};
+	
+	std::vector<Node> nodes{1};
+	
+	public:
+	void insert(const uint8_t * address, size_t prefixBits);
+	[[nodiscard]] bool contains(const uint8_t * address, size_t bits) const noexcept;
+	void clear() { nodes.assign(1, Node{}); }
+	[[nodiscard]] size_t size() const noexcept { return nodes.size(); }
+};
+
+/**
+ * The client whitelist: one IPv4 or IPv6 address or CIDR range per line, such as 10.0.0.0/8
+ * or 2001:db8::/32. The file is compiled into a trie per family and compiled again when a
+ * stat() shows it has changed. The stat is made at most once every StatThrottle::INTERVAL,
+ * so checking a client is usually just a walk over its address bits. IPv4-mapped IPv6
+ * clients are matched against the IPv4 entries.
+ *
+ * A watched Whitelist skips the stat: whoever watches the file calls refresh() when it changes,
+ * from any thread, and the new tries are swapped in atomically. Each thread keeps the tries it
+ * last checked against, and only loads the shared pointer again once a new set is published.
+ */
+class Whitelist : protected Database<1, ','> {
+	struct Tries {
+		AddressTrie ipv4{};
+		AddressTrie ipv6{};
+		struct stat file{}; // What they were compiled from
+	};
+	
+	std::shared_ptr<const Tries> current{}; // Only through std::atomic_load/store
+	std::atomic<uint64_t> generation{0};    // Changed whenever `current` is, unique across Whitelists
+	std::mutex compiling;
+	std::atomic<bool> watched{false};
+	StatThrottle stats{};
+	
+	public:
+	explicit Whitelist(std::string filename) : Database(std::move(filename)) {}
+	
+	/// Whether the whitelist covers the address; false for families other than IPv4 and IPv6
+	bool allows(const sockaddr * address);
+	
+	inline void setWatched(bool watch) noexcept { watched.store(watch, std::memory_order_relaxed); }
+	/// Compiles the file if it has changed and swaps it in. Safe to call from any thread.
+	void refresh() { compile(); }
+	/// Compiles the file again on the next check, whether or not it looks changed
+	void reload() noexcept { publish(nullptr); }
+	
+	private:
+	/// The tries to check against, compiled first if there are none or the file has changed.
+	/// Valid until this thread's next call.
+	const Tries & pin();
+	void publish(std::shared_ptr<const Tries> tries) noexcept;
+	/// Parses "address" or "address/prefix" into an IPv4 or IPv6 entry and adds it
+	static bool add(Tries & tries, std::string_view entry);
+	std::shared_ptr<const Tries> compile();
+};
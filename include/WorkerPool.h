@@ -0,0 +1,45 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs slow work, such as Argon2 hashing, off the select loop. A job runs on a worker thread and
+ * returns a completion, which is handed back to the loop thread: the pool writes to a pipe that
+ * the Selector watches, and the loop calls runCompletions() when it becomes readable. Completions
+ * therefore run on the loop thread and may use server state without locking.
+ */
+class WorkerPool {
+	public:
+	using Completion = std::function<void()>;
+	using Job = std::function<Completion()>;
+	
+	private:
+	std::mutex mutex;
+	std::condition_variable available;
+	std::deque<Job> jobs{};
+	std::vector<Completion> completions{};
+	std::vector<std::thread> threads{};
+	bool stopping = false;
+	int wakeRead = -1;
+	int wakeWrite = -1;
+	
+	public:
+	explicit WorkerPool(size_t threadCount);
+	WorkerPool(const WorkerPool &) = delete;
+	WorkerPool& operator=(const WorkerPool &) = delete;
+	~WorkerPool(); // Waits for running jobs; queued jobs and completions are dropped
+	
+	void submit(Job job);
+	/// The end of the wakeup pipe to watch for readability
+	[[nodiscard]] inline int getFD() const noexcept { return wakeRead; }
+	/// Runs every completion that has arrived. Must be called from the loop thread.
+	void runCompletions();
+	
+	private:
+	void work();
+};
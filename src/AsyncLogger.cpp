@@ -0,0 +1,282 @@
+#include <AsyncLogger.h>
+#include <Database.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+	// A producer can push between the writer's last check and its wait, so the wait is bounded
+	constexpr auto MAX_SLEEP = std::chrono::milliseconds(100);
+	constexpr size_t TIMESTAMP_LENGTH = 19; // YYYY-mm-dd HH:MM:SS
+	constexpr size_t SEGMENT_STAMP_LENGTH = 15; // YYYYmmdd-HHMMSS
+}
+
+AsyncLogger::AsyncLogger(std::string filename, Rotation rotation)
+		: slots(new Slot[CAPACITY]), filename(std::move(filename)), rotation(rotation) {
+	static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+	for (size_t i = 0; i < CAPACITY; i++)
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	
+	openSegment();
+	writer = std::thread(&AsyncLogger::drain, this);
+}
+
+AsyncLogger::~AsyncLogger() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping.store(true);
+	}
+	wakeup.notify_one();
+	writer.join();
+	if (maintenance.joinable())
+		maintenance.join();
+	if (fd >= 0)
+		close(fd);
+}
+
+bool AsyncLogger::log(std::string_view message) {
+	const auto stamp = timestamp(time(nullptr));
+	std::string record{};
+	record.reserve(stamp.length() + 1 + message.length() + 1);
+	record.append(stamp).append(1, '\t');
+	RowWriter::appendEscaped(record, message, '\t');
+	record += '\n';
+	if (!push(std::move(record))) {
+		droppedRecords.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	if (writerWaiting.exchange(false)) {
+		std::lock_guard<std::mutex> lock(mutex);
+		wakeup.notify_one();
+	}
+	return true;
+}
+
+/*
+ * The ring is a bounded queue in the style of Vyukov's: each slot's sequence says whose turn it
+ * is. A slot at position p is free for the producer that claims p when its sequence is p, and
+ * holds a record for the writer when it is p + 1. Producers claim positions with a CAS on
+ * enqueuePosition; there is a single writer, so dequeuePosition needs no synchronization.
+ */
+bool AsyncLogger::push(std::string && record) {
+	auto position = enqueuePosition.load(std::memory_order_relaxed);
+	Slot * slot;
+	while (true) {
+		slot = &slots[position & (CAPACITY - 1)];
+		const auto sequence = slot->sequence.load(std::memory_order_acquire);
+		const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if (difference == 0) {
+			if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		} else if (difference < 0) {
+			return false; // Full
+		} else {
+			position = enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+	slot->record = std::move(record);
+	slot->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+bool AsyncLogger::pop(std::string & batch) {
+	auto & slot = slots[dequeuePosition & (CAPACITY - 1)];
+	if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+		return false;
+	batch += slot.record;
+	slot.record.clear();
+	slot.sequence.store(dequeuePosition + CAPACITY, std::memory_order_release);
+	dequeuePosition++;
+	return true;
+}
+
+void AsyncLogger::drain() {
+	std::string batch{};
+	batch.reserve(MAX_WRITE);
+	while (true) {
+		while (batch.length() < MAX_WRITE && pop(batch));
+		
+		const auto dropped = droppedRecords.load(std::memory_order_relaxed);
+		if (dropped != reportedDrops && batch.length() < MAX_WRITE) {
+			batch.append(timestamp(time(nullptr))).append("\tDropped ")
+					.append(std::to_string(dropped - reportedDrops)).append(" log records\n");
+			reportedDrops = dropped;
+		}
+		if (!batch.empty()) {
+			writeBatch(batch);
+			batch.clear();
+			continue;
+		}
+		if (stopping.load())
+			return;
+		
+		std::unique_lock<std::mutex> lock(mutex);
+		writerWaiting.store(true);
+		if (slots[dequeuePosition & (CAPACITY - 1)].sequence.load() != dequeuePosition + 1 && !stopping.load())
+			wakeup.wait_for(lock, MAX_SLEEP);
+		writerWaiting.store(false);
+	}
+}
+
+void AsyncLogger::writeBatch(const std::string & batch) {
+	if (segmentSize > 0 && ((rotation.maxSize != 0 && segmentSize + batch.length() > rotation.maxSize)
+			|| (rotation.maxAge != 0 && time(nullptr) - segmentStart >= rotation.maxAge)))
+		rollSegment();
+	if (fd < 0)
+		return;
+	for (size_t written = 0; written < batch.length(); ) {
+		const auto n = write(fd, batch.data() + written, batch.length() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "Failed to write to log file: %s\n", strerror(errno));
+			return;
+		}
+		written += static_cast<size_t>(n);
+		segmentSize += static_cast<size_t>(n);
+	}
+}
+
+void AsyncLogger::openSegment() {
+	segmentSize = 0;
+	segmentStart = time(nullptr);
+	fd = open(filename.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open log file %s: %s\n", filename.c_str(), strerror(errno));
+		return;
+	}
+	
+	struct stat info{};
+	if (fstat(fd, &info) != 0)
+		return;
+	segmentSize = static_cast<size_t>(info.st_size);
+	// Don't run into a last line that was written without its newline
+	char last = '\n';
+	if (info.st_size > 0 && pread(fd, &last, 1, info.st_size - 1) == 1 && last != '\n' && write(fd, "\n", 1) == 1)
+		segmentSize++;
+}
+
+void AsyncLogger::rollSegment() {
+	// Segments are named for when they were closed, so their names sort oldest first
+	const auto now = time(nullptr);
+	tm local{};
+	localtime_r(&now, &local);
+	std::array<char, SEGMENT_STAMP_LENGTH + 1> closed{};
+	strftime(closed.data(), closed.size(), "%Y%m%d-%H%M%S", &local);
+	auto segment = filename + "." + closed.data();
+	for (int i = 1; access(segment.c_str(), F_OK) == 0 || access((segment + ".gz").c_str(), F_OK) == 0; i++)
+		segment = filename + "." + closed.data() + "-" + std::to_string(i);
+	
+	if (fd >= 0)
+		close(fd);
+	const bool renamed = rename(filename.c_str(), segment.c_str()) == 0;
+	if (!renamed)
+		fprintf(stderr, "Failed to roll log file %s: %s\n", filename.c_str(), strerror(errno));
+	openSegment();
+	if (!renamed)
+		return;
+	
+	if (maintenance.joinable())
+		maintenance.join();
+	maintenance = std::thread([segment, filename = filename, keep = rotation.keep]() {
+		compressSegment(segment);
+		if (keep != 0)
+			pruneSegments(filename, keep);
+	});
+}
+
+/// Replaces the segment with a gzip of it; without zlib, segments are left as they are
+void AsyncLogger::compressSegment(const std::string & segment) {
+#ifdef HAVE_ZLIB
+	const auto compressed = segment + ".gz";
+	const auto partial = compressed + ".tmp";
+	const int input = open(segment.c_str(), O_RDONLY | O_CLOEXEC);
+	if (input < 0)
+		return;
+	gzFile output = gzopen(partial.c_str(), "wb");
+	bool failed = output == nullptr;
+	std::vector<char> buffer(MAX_WRITE);
+	while (!failed) {
+		const auto n = read(input, buffer.data(), buffer.size());
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			failed = n < 0;
+			break;
+		}
+		failed = gzwrite(output, buffer.data(), static_cast<unsigned>(n)) != n;
+	}
+	close(input);
+	if (output != nullptr && gzclose(output) != Z_OK)
+		failed = true;
+	
+	if (failed || rename(partial.c_str(), compressed.c_str()) != 0) {
+		fprintf(stderr, "Failed to compress log segment %s\n", segment.c_str());
+		unlink(partial.c_str());
+		return;
+	}
+	unlink(segment.c_str());
+#endif
+}
+
+/// Deletes all but the newest `keep` closed segments of `filename`, compressed or not
+void AsyncLogger::pruneSegments(const std::string & filename, size_t keep) {
+	const auto slash = filename.rfind('/');
+	const auto directory = slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+	const auto prefix = filename.substr(directory.length()) + ".";
+	
+	DIR * dir = opendir(directory.empty() ? "." : directory.c_str());
+	if (dir == nullptr)
+		return;
+	std::vector<std::string> segments{};
+	while (const auto entry = readdir(dir)) {
+		const std::string_view name(entry->d_name);
+		if (name.length() > prefix.length() && name.compare(0, prefix.length(), prefix) == 0
+				&& isdigit(static_cast<unsigned char>(name[prefix.length()])) && name.substr(name.length() - 4) != ".tmp")
+			segments.emplace_back(name);
+	}
+	closedir(dir);
+	
+	if (segments.size() <= keep)
+		return;
+	// By close time, then by the counter that tells apart segments closed in the same second
+	const auto order = [&prefix](const std::string & segment) {
+		const auto closed = segment.substr(prefix.length(), SEGMENT_STAMP_LENGTH);
+		const auto counter = segment.length() > prefix.length() + closed.length() && segment[prefix.length() + closed.length()] == '-'
+				? strtoul(segment.c_str() + prefix.length() + closed.length() + 1, nullptr, 10) : 0;
+		return std::make_pair(closed, counter);
+	};
+	std::sort(segments.begin(), segments.end(), [&order](const auto & a, const auto & b) { return order(a) < order(b); });
+	for (size_t i = 0; i + keep < segments.size(); i++)
+		unlink((directory + segments[i]).c_str());
+}
+
+std::string_view AsyncLogger::timestamp(time_t now) {
+	thread_local time_t second = -1;
+	thread_local std::array<char, TIMESTAMP_LENGTH + 1> formatted{};
+	if (now != second) {
+		tm local{};
+		localtime_r(&now, &local);
+		strftime(formatted.data(), formatted.size(), "%Y-%m-%d %H:%M:%S", &local);
+		second = now;
+	}
+	return std::string_view(formatted.data());
+}
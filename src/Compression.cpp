@@ -0,0 +1,238 @@
+#include <Compression.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+	/*
+	 * The LZ codec follows the LZ4 block layout: each sequence is a token (literal count in the
+	 * high nibble, match length - MIN_MATCH in the low), the literals, a little-endian 16-bit
+	 * offset back into the output and the match. A nibble of 15 continues in following bytes,
+	 * each added on until one is below 255. The last sequence is literals only.
+	 */
+	constexpr size_t MIN_MATCH = 4;
+	constexpr size_t MAX_OFFSET = UINT16_MAX;
+	constexpr size_t HASH_BITS = 12;
+	constexpr uint8_t NIBBLE_MAX = 15;
+	
+	inline uint32_t hashSequence(const uint8_t * input) noexcept {
+		uint32_t sequence;
+		memcpy(&sequence, input, sizeof(sequence));
+		return (sequence * 2654435761u) >> (32u - HASH_BITS);
+	}
+	
+	inline void appendLength(std::vector<BufferByte> & output, size_t length) {
+		for (; length >= 255; length -= 255)
+			output.push_back(static_cast<BufferByte>(255));
+		output.push_back(static_cast<BufferByte>(length));
+	}
+	
+	/// Returns false if the continuation runs off the end of the input
+	inline bool readLength(const uint8_t * input, size_t length, size_t & position, size_t & value) noexcept {
+		uint8_t byte;
+		do {
+			if (position >= length)
+				return false;
+			byte = input[position++];
+			value += byte;
+		} while (byte == 255);
+		return true;
+	}
+	
+	void appendSequence(std::vector<BufferByte> & output, const uint8_t * literals, size_t literalLength, size_t offset, size_t matchLength) {
+		const auto matchCode = matchLength - MIN_MATCH;
+		const auto token = static_cast<uint8_t>(std::min<size_t>(literalLength, NIBBLE_MAX) << 4u | std::min<size_t>(matchCode, NIBBLE_MAX));
+		output.push_back(static_cast<BufferByte>(token));
+		if (literalLength >= NIBBLE_MAX)
+			appendLength(output, literalLength - NIBBLE_MAX);
+		output.insert(output.end(), literals, literals + literalLength);
+		output.push_back(static_cast<BufferByte>(offset & 0xFFu));
+		output.push_back(static_cast<BufferByte>(offset >> 8u));
+		if (matchCode >= NIBBLE_MAX)
+			appendLength(output, matchCode - NIBBLE_MAX);
+	}
+	
+	void appendLastLiterals(std::vector<BufferByte> & output, const uint8_t * literals, size_t literalLength) {
+		output.push_back(static_cast<BufferByte>(std::min<size_t>(literalLength, NIBBLE_MAX) << 4u));
+		if (literalLength >= NIBBLE_MAX)
+			appendLength(output, literalLength - NIBBLE_MAX);
+		output.insert(output.end(), literals, literals + literalLength);
+	}
+}
+
+std::optional<Compression::Codec> Compression::codecFor(uint32_t capabilities) noexcept {
+#ifdef HAVE_ZLIB
+	if ((capabilities & Capability::COMPRESSION_ZLIB) != 0)
+		return Codec::ZLIB;
+#endif
+	if ((capabilities & Capability::COMPRESSION) != 0)
+		return Codec::LZ;
+	return std::nullopt;
+}
+
+std::optional<std::vector<BufferByte>> Compression::compress(Codec codec, std::string_view input) {
+	if (input.length() < THRESHOLD)
+		return std::nullopt;
+	
+	std::vector<BufferByte> output{};
+	output.reserve(1 + Varint::MAX_LENGTH + input.length());
+	output.push_back(static_cast<BufferByte>(codec));
+	output.resize(1 + Varint::length(input.length()));
+	Varint::encode(output.data() + 1, input.length());
+	
+	const auto data = reinterpret_cast<const uint8_t *>(input.data());
+	switch (codec) {
+		case Codec::LZ:
+			compressLZ(data, input.length(), output);
+			break;
+#ifdef HAVE_ZLIB
+		case Codec::ZLIB:
+			if (!compressZlib(data, input.length(), output))
+				return std::nullopt;
+			break;
+#endif
+		default:
+			return std::nullopt;
+	}
+	if (output.size() >= input.length())
+		return std::nullopt;
+	return output;
+}
+
+bool Compression::decompress(const BufferByte * payload, size_t length, std::string & output) {
+	if (length < 2)
+		return false;
+	uint64_t decompressedLength = 0;
+	const auto consumed = Varint::decode(payload + 1, length - 1, decompressedLength);
+	if (consumed == 0 || decompressedLength > MAX_DECOMPRESSED)
+		return false;
+	
+	const auto data = reinterpret_cast<const uint8_t *>(payload) + 1 + consumed;
+	const auto dataLength = length - 1 - consumed;
+	output.clear();
+	output.reserve(std::min<uint64_t>(decompressedLength, dataLength * RESERVE_RATIO));
+	switch (static_cast<Codec>(payload[0])) {
+		case Codec::LZ:
+			if (!decompressLZ(data, dataLength, decompressedLength, output))
+				return false;
+			break;
+#ifdef HAVE_ZLIB
+		case Codec::ZLIB:
+			if (!decompressZlib(data, dataLength, decompressedLength, output))
+				return false;
+			break;
+#endif
+		default:
+			return false;
+	}
+	return output.length() == decompressedLength;
+}
+
+void Compression::compressLZ(const uint8_t * input, size_t length, std::vector<BufferByte> & output) {
+	std::array<uint32_t, 1u << HASH_BITS> table{};
+	table.fill(UINT32_MAX);
+	
+	size_t anchor = 0;
+	size_t position = 0;
+	while (position + MIN_MATCH <= length) {
+		const auto hash = hashSequence(input + position);
+		const auto candidate = static_cast<size_t>(table[hash]);
+		table[hash] = static_cast<uint32_t>(position);
+		if (candidate == UINT32_MAX || position - candidate > MAX_OFFSET || memcmp(input + candidate, input + position, MIN_MATCH) != 0) {
+			position++;
+			continue;
+		}
+		
+		auto matchLength = MIN_MATCH;
+		while (position + matchLength < length && input[candidate + matchLength] == input[position + matchLength])
+			matchLength++;
+		appendSequence(output, input + anchor, position - anchor, position - candidate, matchLength);
+		position += matchLength;
+		anchor = position;
+	}
+	appendLastLiterals(output, input + anchor, length - anchor);
+}
+
+bool Compression::decompressLZ(const uint8_t * input, size_t length, size_t limit, std::string & output) {
+	size_t position = 0;
+	while (position < length) {
+		const auto token = input[position++];
+		size_t literalLength = token >> 4u;
+		if (literalLength == NIBBLE_MAX && !readLength(input, length, position, literalLength))
+			return false;
+		if (literalLength > length - position || output.length() + literalLength > limit)
+			return false;
+		output.append(reinterpret_cast<const char *>(input + position), literalLength);
+		position += literalLength;
+		if (position == length)
+			break; // Last sequence has no match
+		
+		if (length - position < 2)
+			return false;
+		const auto offset = static_cast<size_t>(input[position] | input[position + 1] << 8u);
+		position += 2;
+		size_t matchLength = token & NIBBLE_MAX;
+		if (matchLength == NIBBLE_MAX && !readLength(input, length, position, matchLength))
+			return false;
+		matchLength += MIN_MATCH;
+		if (offset == 0 || offset > output.length() || output.length() + matchLength > limit)
+			return false;
+		
+		// A match may overlap what it produces, so copy at most what already exists each time
+		for (auto source = output.length() - offset; matchLength > 0; ) {
+			const auto piece = std::min(matchLength, output.length() - source);
+			output.append(output, source, piece);
+			source += piece;
+			matchLength -= piece;
+		}
+	}
+	return true;
+}
+
+#ifdef HAVE_ZLIB
+bool Compression::compressZlib(const uint8_t * input, size_t length, std::vector<BufferByte> & output) {
+	const auto prefix = output.size();
+	auto compressedLength = compressBound(length);
+	output.resize(prefix + compressedLength);
+	if (compress2(reinterpret_cast<Bytef *>(output.data() + prefix), &compressedLength, input, length, Z_BEST_SPEED) != Z_OK)
+		return false;
+	output.resize(prefix + compressedLength);
+	return true;
+}
+
+bool Compression::decompressZlib(const uint8_t * input, size_t length, size_t limit, std::string & output) {
+	z_stream stream{};
+	if (inflateInit(&stream) != Z_OK)
+		return false;
+	stream.next_in = const_cast<Bytef *>(input);
+	stream.avail_in = static_cast<uInt>(length);
+	
+	// Grow the output as it is inflated, doubling up to the limit
+	int result = Z_OK;
+	while (result == Z_OK && output.length() < limit) {
+		const auto produced = output.length();
+		const auto room = std::min(limit - produced, std::max(produced, output.capacity() - produced) + 1);
+		output.resize(produced + room);
+		stream.next_out = reinterpret_cast<Bytef *>(&output[produced]);
+		stream.avail_out = static_cast<uInt>(room);
+		result = inflate(&stream, Z_NO_FLUSH);
+		output.resize(produced + room - stream.avail_out);
+	}
+	inflateEnd(&stream);
+	return result == Z_STREAM_END;
+}
+#endif
+
+size_t CompressedMessage::encodeInto(BufferByte * dst, size_t capacity) const noexcept {
+	const auto length = encodedSize();
+	if (capacity < length)
+		return 0;
+	const auto header = FrameHeader::encode(dst, payload.size(), static_cast<MessageType>(static_cast<uint8_t>(type) | FrameHeader::COMPRESSED));
+	memcpy(dst + header, payload.data(), payload.size());
+	return length;
+}
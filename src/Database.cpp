@@ -1,2 +1,138 @@
 #include <Database.h>
 
+#include <sys/mman.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DATABASE_SCAN_X86
+#endif
+
+MappedFile::MappedFile(const std::string & filename) {
+	fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	struct stat info{};
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+		return;
+	void * mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+		return;
+	madvise(mapping, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+	data = static_cast<const char *>(mapping);
+	length = static_cast<size_t>(info.st_size);
+}
+
+MappedFile::~MappedFile() {
+	if (data != nullptr)
+		munmap(const_cast<char *>(data), length);
+	if (fd >= 0)
+		close(fd);
+}
+
+namespace {
+	inline bool isSpecial(char c, char delimiter) noexcept {
+		return c == delimiter || c == '\\' || DatabaseScan::isLineEnd(c);
+	}
+	
+	inline const char * findSpecialScalar(const char * p, const char * end, char delimiter) noexcept {
+		for (; p < end; p++) {
+			if (isSpecial(*p, delimiter))
+				return p;
+		}
+		return end;
+	}
+
+#ifdef DATABASE_SCAN_X86
+	/*
+	 * The 16-byte search is inlined into the AVX2 one too, so that its tail is VEX encoded.
+	 * Calling legacy SSE code with dirty upper registers stalls on every call.
+	 */
+	__attribute__((always_inline))
+	inline const char * findSpecial16(const char * p, const char * end, char delimiter) noexcept {
+		const auto delimiters = _mm_set1_epi8(delimiter);
+		const auto backslashes = _mm_set1_epi8('\\');
+		const auto newlines = _mm_set1_epi8('\n');
+		const auto returns = _mm_set1_epi8('\r');
+		for (; end - p >= 16; p += 16) {
+			const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+			const auto matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, delimiters), _mm_cmpeq_epi8(block, backslashes)),
+					_mm_or_si128(_mm_cmpeq_epi8(block, newlines), _mm_cmpeq_epi8(block, returns)));
+			const auto mask = static_cast<unsigned>(_mm_movemask_epi8(matches));
+			if (mask != 0)
+				return p + __builtin_ctz(mask);
+		}
+		return findSpecialScalar(p, end, delimiter);
+	}
+	
+	__attribute__((target("sse2")))
+	const char * findSpecialSSE2(const char * p, const char * end, char delimiter) noexcept {
+		return findSpecial16(p, end, delimiter);
+	}
+	
+	__attribute__((target("avx2")))
+	const char * findSpecialAVX2(const char * p, const char * end, char delimiter) noexcept {
+		const auto delimiters = _mm256_set1_epi8(delimiter);
+		const auto backslashes = _mm256_set1_epi8('\\');
+		const auto newlines = _mm256_set1_epi8('\n');
+		const auto returns = _mm256_set1_epi8('\r');
+		for (; end - p >= 32; p += 32) {
+			const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+			const auto matches = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, delimiters), _mm256_cmpeq_epi8(block, backslashes)),
+					_mm256_or_si256(_mm256_cmpeq_epi8(block, newlines), _mm256_cmpeq_epi8(block, returns)));
+			const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(matches));
+			if (mask != 0)
+				return p + __builtin_ctz(mask);
+		}
+		return findSpecial16(p, end, delimiter);
+	}
+#endif
+	
+	using FindSpecial = const char * (*)(const char *, const char *, char) noexcept;
+	
+	FindSpecial selectFindSpecial() noexcept {
+#ifdef DATABASE_SCAN_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return &findSpecialAVX2;
+		if (__builtin_cpu_supports("sse2"))
+			return &findSpecialSSE2;
+#endif
+		return &findSpecialScalar;
+	}
+}
+
+const char * DatabaseScan::findSpecial(const char * p, const char * end, char delimiter) noexcept {
+	static const FindSpecial implementation = selectFindSpecial();
+	return implementation(p, end, delimiter);
+}
+
+bool RowWriter::flush() {
+	for (size_t written = 0; !failed && written < buffer.length(); ) {
+		const auto n = write(fd, buffer.data() + written, buffer.length() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			failed = true;
+		else
+			written += static_cast<size_t>(n);
+	}
+	buffer.clear();
+	return !failed;
+}
+
+void RowWriter::appendEscaped(std::string & out, std::string_view column, char delimiter) {
+	const auto end = column.data() + column.length();
+	for (auto p = column.data(); p < end; ) {
+		const auto special = DatabaseScan::findSpecial(p, end, delimiter);
+		out.append(p, static_cast<size_t>(special - p));
+		if (special == end)
+			break;
+		if (DatabaseScan::isLineEnd(*special)) {
+			out += ' ';
+		} else {
+			out += '\\';
+			out += *special;
+		}
+		p = special + 1;
+	}
+}
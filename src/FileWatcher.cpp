@@ -0,0 +1,67 @@
+#include <FileWatcher.h>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+	// Writes that finish, and files moved in, out, created or deleted
+	constexpr uint32_t CHANGE_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+}
+
+FileWatcher::FileWatcher() {
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		fprintf(stderr, "Failed to start watching files: %s\n", strerror(errno));
+}
+
+FileWatcher::~FileWatcher() {
+	if (fd >= 0)
+		close(fd);
+}
+
+bool FileWatcher::watch(const std::string & filename, std::function<void()> onChange) {
+	if (fd < 0)
+		return false;
+	const auto slash = filename.rfind('/');
+	const auto directory = slash == std::string::npos ? std::string(".") : filename.substr(0, slash + 1);
+	// Watching a directory again returns the same descriptor
+	const int wd = inotify_add_watch(fd, directory.c_str(), CHANGE_EVENTS | IN_ONLYDIR);
+	if (wd < 0) {
+		fprintf(stderr, "Failed to watch %s: %s\n", filename.c_str(), strerror(errno));
+		return false;
+	}
+	watches.push_back({wd, slash == std::string::npos ? filename : filename.substr(slash + 1), std::move(onChange)});
+	return true;
+}
+
+void FileWatcher::handleEvents() {
+	std::vector<bool> changed(watches.size(), false);
+	alignas(inotify_event) std::array<char, 4096> events{};
+	while (true) {
+		const auto length = read(fd, events.data(), events.size());
+		if (length < 0 && errno == EINTR)
+			continue;
+		if (length <= 0)
+			break;
+		
+		for (ssize_t offset = 0; offset < length; ) {
+			const auto event = reinterpret_cast<const inotify_event *>(events.data() + offset);
+			offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+			for (size_t i = 0; i < watches.size(); i++) {
+				// Events were lost, so any file may have changed
+				if ((event->mask & IN_Q_OVERFLOW) != 0
+						|| (event->wd == watches[i].directory && event->len > 0 && watches[i].name == event->name))
+					changed[i] = true;
+			}
+		}
+	}
+	
+	for (size_t i = 0; i < watches.size(); i++) {
+		if (changed[i])
+			watches[i].onChange();
+	}
+}
@@ -1,2 +1,129 @@
 #include <NetworkMessage.h>
 
+bool HelloMessage::decode(const BufferByte * payload, size_t length) noexcept {
+	negotiate = length > 0;
+	return !negotiate || Negotiation::decode(payload, length, *this);
+}
+
+size_t HelloMessage::encodeInto(BufferByte * dst, size_t capacity) const noexcept {
+	const auto length = encodedSize();
+	if (capacity < length)
+		return 0;
+	const auto header = FrameHeader::encode(dst, length - FrameHeader::LENGTH, TYPE);
+	if (negotiate)
+		Negotiation::encode(dst + header, *this);
+	return length;
+}
+
+bool StreamProducer::operator()(DynamicBuffer & out) {
+	if (!begun) {
+		StreamBegin(id, contentType).encodeInto(out);
+		begun = true;
+	}
+	
+	// Leave room for the header, then have the source fill the chunk in place
+	const auto prefix = FrameHeader::LENGTH + Varint::length(id);
+	static_assert(FrameHeader::LENGTH + Varint::MAX_LENGTH + CHUNK_SIZE <= UINT16_MAX, "Chunks must fit in a short frame");
+	auto dst = out.reserve(prefix + CHUNK_SIZE);
+	const auto produced = source(dst + prefix, CHUNK_SIZE);
+	if (produced == 0) {
+		out.commit(0);
+		StreamEnd(id).encodeInto(out);
+		return false;
+	}
+	assert(produced <= CHUNK_SIZE);
+	FrameHeader::encode(dst, prefix - FrameHeader::LENGTH + produced, StreamChunk::TYPE);
+	Varint::encode(dst + FrameHeader::LENGTH, id);
+	out.commit(prefix + produced);
+	return true;
+}
+
+bool BatchMessage::decode(const BufferByte * payload, size_t length) noexcept {
+	uint64_t messages = 0;
+	const auto countLength = Varint::decode(payload, length, messages);
+	if (countLength == 0 || messages > length) // Every entry takes at least two bytes
+		return false;
+	
+	// Walk the table to make sure every payload is in bounds before anything is dispatched
+	size_t offset = countLength;
+	size_t consumed;
+	uint64_t total = 0;
+	for (uint64_t i = 0; i < messages; i++) {
+		if (offset >= length)
+			return false;
+		offset++; // type
+		uint64_t messageLength = 0;
+		consumed = Varint::decode(payload + offset, length - offset, messageLength);
+		if (consumed == 0 || messageLength > length)
+			return false;
+		offset += consumed;
+		total += messageLength;
+	}
+	if (total != length - offset)
+		return false;
+	
+	count = static_cast<size_t>(messages);
+	table = payload + countLength;
+	payloads = payload + offset;
+	return true;
+}
+
+bool BatchBuilder::add(const Buffer & frame) {
+	assert(frame.length() >= FrameHeader::LENGTH);
+	if (!fits(frame.length()))
+		return false;
+	frames.insert(frames.end(), frame.data(), frame.data() + frame.length());
+	account(frame.length());
+	return true;
+}
+
+void BatchBuilder::clear() noexcept {
+	frames.clear();
+	count = 0;
+	tableLength = 0;
+	payloadLength = 0;
+}
+
+size_t BatchBuilder::encodedSize() const noexcept {
+	if (count == 1)
+		return frames.size();
+	return FrameHeader::LENGTH + Varint::length(count) + tableLength + payloadLength;
+}
+
+size_t BatchBuilder::encodeInto(BufferByte * dst, size_t capacity) const noexcept {
+	const auto length = encodedSize();
+	if (capacity < length)
+		return 0;
+	if (count == 1) {
+		memcpy(dst, frames.data(), length);
+		return length;
+	}
+	FrameHeader::encode(dst, length - FrameHeader::LENGTH, BatchMessage::TYPE);
+	auto entry = dst + FrameHeader::LENGTH;
+	entry += Varint::encode(entry, count);
+	auto data = entry + tableLength;
+	for (size_t offset = 0; offset < frames.size(); ) {
+		const auto frameLength = static_cast<size_t>(static_cast<uint8_t>(frames[offset]) << 8u | static_cast<uint8_t>(frames[offset+1]));
+		const auto messageLength = frameLength - FrameHeader::LENGTH;
+		*entry++ = frames[offset+2];
+		entry += Varint::encode(entry, messageLength);
+		memcpy(data, frames.data() + offset + FrameHeader::LENGTH, messageLength);
+		data += messageLength;
+		offset += frameLength;
+	}
+	assert(static_cast<size_t>(data - dst) == length);
+	return length;
+}
+
+bool BatchBuilder::fits(size_t frameLength) const noexcept {
+	const auto messageLength = frameLength - FrameHeader::LENGTH;
+	const auto grown = FrameHeader::LENGTH + Varint::length(count + 1) + tableLength + 1 + Varint::length(messageLength) + payloadLength + messageLength;
+	return grown <= UINT16_MAX;
+}
+
+void BatchBuilder::account(size_t frameLength) noexcept {
+	const auto messageLength = frameLength - FrameHeader::LENGTH;
+	count++;
+	tableLength += 1 + Varint::length(messageLength);
+	payloadLength += messageLength;
+}
@@ -4,13 +4,18 @@
 #include <iostream>
 #include <algorithm>
 #include <cstring>
-#include <list>
+#include <cstddef>
+#include <cerrno>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "PasswdMgr.h"
-#include "FileDesc.h"
-#include "strfuncts.h"
 
-const int hashlen = 32;
-const int saltlen = 16;
+static const char pwmagic[4] = {'P', 'W', 'D', '1'};
 
 PasswdMgr::PasswdMgr(const char *pwd_file):_pwd_file(pwd_file) {
 
@@ -18,7 +23,7 @@ PasswdMgr::PasswdMgr(const char *pwd_file):_pwd_file(pwd_file) {
 
 
 PasswdMgr::~PasswdMgr() {
-
+   unmapFile();
 }
 
 /*******************************************************************************************
@@ -29,12 +34,7 @@ PasswdMgr::~PasswdMgr() {
  *******************************************************************************************/
 
 bool PasswdMgr::checkUser(const char *name) {
-   std::vector<uint8_t> passwd, salt;
-
-   bool result = findUser(name, passwd, salt);
-
-   return result;
-     
+   return findRecord(name) != NULL;
 }
 
 /*******************************************************************************************
@@ -43,7 +43,7 @@ bool PasswdMgr::checkUser(const char *name) {
  *
  *    Params:  name - username string to check (case insensitive)
  *             passwd - password string to hash and compare (case sensitive)
- *    
+ *
  *    Returns: true if correct password was given, false otherwise
  *
  *    Throws: pwfile_error if there were unanticipated problems opening the password file for
@@ -81,58 +81,79 @@ bool PasswdMgr::checkPasswd(const char *name, const char *passwd) {
  *******************************************************************************************/
 
 bool PasswdMgr::changePasswd(const char *name, const char *passwd) {
+   if (findRecord(name) == NULL)
+      return false;
 
-   // Insert your insane code here
+   // Hashed before taking the lock, which would otherwise be held for the whole hash
+   std::vector<uint8_t> hash, salt;
+   hashArgon2(hash, salt, passwd);
 
-   return true;
-}
+   // Records are fixed width, so the new hash and salt (adjacent in the record) overwrite
+   // the old ones without moving anything else
+   uint8_t update[hashlen + saltlen];
+   memcpy(update, hash.data(), hashlen);
+   memcpy(update + hashlen, salt.data(), saltlen);
 
-/*****************************************************************************************************
- * readUser - Taking in an opened File Descriptor of the password file, reads in a user entry and
- *            loads the passed in variables
- *
- *    Params:  pwfile - FileDesc of password file already opened for reading
- *             name - std string to store the name read in
- *             hash, salt - vectors to store the read-in hash and salt respectively
- *
- *    Returns: true if a new entry was read, false if eof reached 
- * 
- *    Throws: pwfile_error exception if the file appeared corrupted
- *
- *****************************************************************************************************/
-
-bool PasswdMgr::readUser(FileFD &pwfile, std::string &name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt)
-{
-   // Insert your perfect code here!
+   // The file may have been replaced while hashing, so look the record up again under the lock
+   int fd = lockFile(O_WRONLY);
+   if (fd < 0)
+      return false;
+   const Record *record = NULL;
+   try {
+      record = findRecord(name);
+   } catch (...) {
+      close(fd);
+      throw;
+   }
+   if (record == NULL) {
+      close(fd);
+      return false;
+   }
+   off_t offset = reinterpret_cast<const char *>(record) - _map + offsetof(Record, hash);
+   ssize_t written = pwrite(fd, update, sizeof(update), offset);
+   close(fd);
+   if (written != static_cast<ssize_t>(sizeof(update)))
+      throw pwfile_error("Failed to write the new password to the passwd file");
 
    return true;
 }
 
 /*****************************************************************************************************
- * writeUser - Taking in an opened File Descriptor of the password file, writes a user entry to disk
+ * findRecord - Binary searches the mapped password file for a user
  *
- *    Params:  pwfile - FileDesc of password file already opened for writing
- *             name - std string of the name 
- *             hash, salt - vectors of the hash and salt to write to disk
+ *    Params:  name - the username to search for (case insensitive)
  *
- *    Returns: bytes written
+ *    Returns: the user's record within the mapping, or NULL if not found. It is only valid until
+ *             the next call that remaps the file.
  *
- *    Throws: pwfile_error exception if the writes fail
+ *    Throws: pwfile_error exception if the pwfile could not be read or appeared corrupted
  *
  *****************************************************************************************************/
 
-int PasswdMgr::writeUser(FileFD &pwfile, std::string &name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt)
-{
-   int results = 0;
-
-   // Insert your wild code here!
-
-   return results; 
+const PasswdMgr::Record *PasswdMgr::findRecord(const char *name) {
+   char key[namelen];
+   if (!makeKey(name, key))
+      return NULL;
+
+   mapFile();
+   if (_map == NULL)
+      return NULL;
+
+   const Header *header = reinterpret_cast<const Header *>(_map);
+   const Record *first = reinterpret_cast<const Record *>(_map + sizeof(Header));
+   const Record *last = first + header->count;
+   const Record *found = std::lower_bound(first, last, key, [](const Record &record, const char *k) {
+      return memcmp(record.name, k, namelen) < 0;
+   });
+
+   if (found == last || memcmp(found->name, key, namelen) != 0)
+      return NULL;
+   return found;
 }
 
 /*****************************************************************************************************
- * findUser - Reads in the password file, finding the user (if they exist) and populating the two
- *            passed in vectors with their hash and salt
+ * findUser - Looks up the user (if they exist) and populates the two passed in vectors with their
+ *            hash and salt
  *
  *    Params:  name - the username to search for
  *             hash - vector to store the user's password hash
@@ -140,65 +161,269 @@ int PasswdMgr::writeUser(FileFD &pwfile, std::string &name, std::vector<uint8_t>
  *
  *    Returns: true if found, false if not
  *
- *    Throws: pwfile_error exception if the pwfile could not be opened for reading
+ *    Throws: pwfile_error exception if the pwfile could not be read or appeared corrupted
  *
  *****************************************************************************************************/
 
 bool PasswdMgr::findUser(const char *name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt) {
+   const Record *record = findRecord(name);
+   if (record == NULL) {
+      hash.clear();
+      salt.clear();
+      return false;
+   }
 
-   FileFD pwfile(_pwd_file.c_str());
+   hash.assign(record->hash, record->hash + hashlen);
+   salt.assign(record->salt, record->salt + saltlen);
+   return true;
+}
 
-   // You may need to change this code for your specific implementation
+/*****************************************************************************************************
+ * makeKey - Converts a username into its on-disk form: lowercased and zero-padded to namelen
+ *
+ *    Returns: false if the name is empty or too long to be stored
+ *
+ *****************************************************************************************************/
 
-   if (!pwfile.openFile(FileFD::readfd))
-      throw pwfile_error("Could not open passwd file for reading");
+bool PasswdMgr::makeKey(const char *name, char (&key)[namelen]) {
+   size_t length = strlen(name);
+   if (length == 0 || length >= namelen)
+      return false;
 
-   // Password file should be in the format username\n{32 byte hash}{16 byte salt}\n
-   bool eof = false;
-   while (!eof) {
-      std::string uname;
+   memset(key, 0, namelen);
+   for (size_t i = 0; i < length; i++)
+      key[i] = tolower(static_cast<unsigned char>(name[i]));
+   return true;
+}
 
-      if (!readUser(pwfile, uname, hash, salt)) {
-         eof = true;
-         continue;
-      }
+/*****************************************************************************************************
+ * lockFile - Opens the password file with the given flags and takes an exclusive flock on it.
+ *            A writer that replaces the file does so while holding the lock on the old one, so
+ *            the file is opened again until the one locked is still the one at the path. The
+ *            mapping then matches it for as long as the lock is held.
+ *
+ *    Returns: the locked descriptor, which unlocks when closed, or -1 if the file doesn't exist
+ *             and flags don't include O_CREAT
+ *
+ *    Throws: pwfile_error exception if the pwfile could not be opened or locked
+ *
+ *****************************************************************************************************/
 
-      if (!uname.compare(name)) {
-         pwfile.closeFD();
-         return true;
+int PasswdMgr::lockFile(int flags) {
+   while (true) {
+      int fd = open(_pwd_file.c_str(), flags | O_CLOEXEC, S_IRUSR | S_IWUSR);
+      if (fd < 0) {
+         if (errno == ENOENT && (flags & O_CREAT) == 0)
+            return -1;
+         throw pwfile_error(std::string("Could not open passwd file for writing: ") + strerror(errno));
+      }
+      int locked;
+      while ((locked = flock(fd, LOCK_EX)) != 0 && errno == EINTR)
+         ;
+      if (locked != 0) {
+         int error = errno;
+         close(fd);
+         throw pwfile_error(std::string("Could not lock passwd file: ") + strerror(error));
       }
+
+      struct stat opened, current;
+      if (fstat(fd, &opened) == 0 && stat(_pwd_file.c_str(), &current) == 0 &&
+          opened.st_dev == current.st_dev && opened.st_ino == current.st_ino)
+         return fd;
+      close(fd);
    }
+}
 
-   hash.clear();
-   salt.clear();
-   pwfile.closeFD();
-   return false;
+/*****************************************************************************************************
+ * mapFile - Makes sure the current password file is mapped. The mapping is kept between calls
+ *           and only replaced when the file has been replaced or resized, so a lookup normally
+ *           costs one stat. A missing or empty file maps to no users.
+ *
+ *    Throws: pwfile_error exception if the pwfile could not be read or appeared corrupted
+ *
+ *****************************************************************************************************/
+
+void PasswdMgr::mapFile() {
+   struct stat st;
+   if (stat(_pwd_file.c_str(), &st) != 0) {
+      if (errno != ENOENT)
+         throw pwfile_error(std::string("Could not open passwd file for reading: ") + strerror(errno));
+      unmapFile();
+      return;
+   }
+   if (st.st_dev == _dev && st.st_ino == _ino && st.st_size == _size)
+      return;
+
+   unmapFile();
+   int fd = open(_pwd_file.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      if (errno == ENOENT)
+         return;
+      throw pwfile_error(std::string("Could not open passwd file for reading: ") + strerror(errno));
+   }
+   // The file may have been replaced since the stat, so map whatever was actually opened
+   if (fstat(fd, &st) != 0) {
+      int error = errno;
+      close(fd);
+      throw pwfile_error(std::string("Could not open passwd file for reading: ") + strerror(error));
+   }
+   _dev = st.st_dev;
+   _ino = st.st_ino;
+   _size = st.st_size;
+   if (st.st_size == 0) {
+      close(fd);
+      return;
+   }
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      throw pwfile_error(std::string("Could not map passwd file: ") + strerror(errno));
+   _map = static_cast<const char *>(map);
+   _maplen = st.st_size;
+
+   const Header *header = reinterpret_cast<const Header *>(_map);
+   if (_maplen < sizeof(Header) || memcmp(header->magic, pwmagic, sizeof(pwmagic)) != 0 ||
+       header->recordsize != sizeof(Record) ||
+       header->count != (_maplen - sizeof(Header)) / sizeof(Record) ||
+       (_maplen - sizeof(Header)) % sizeof(Record) != 0) {
+      unmapFile();
+      throw pwfile_error("Passwd file appears corrupted");
+   }
+}
+
+void PasswdMgr::unmapFile() {
+   if (_map != NULL)
+      munmap(const_cast<char *>(_map), _maplen);
+   _map = NULL;
+   _maplen = 0;
+   _size = -1;
 }
 
 
 /*****************************************************************************************************
  * hashArgon2 - Performs a hash on the password using the Argon2 library. Implementation algorithm
- *              taken from the http://github.com/P-H-C/phc-winner-argon2 example. 
+ *              taken from the http://github.com/P-H-C/phc-winner-argon2 example.
  *
- *    Params:  dest - the std string object to store the hash
+ *    Params:  ret_hash - vector to store the raw hash
+ *             ret_salt - vector to store the salt used
  *             passwd - the password to be hashed
+ *             in_salt - the salt to use, or NULL to generate a new one
  *
  *    Throws: runtime_error if the salt passed in is not the right size
  *****************************************************************************************************/
-void PasswdMgr::hashArgon2(std::vector<uint8_t> &ret_hash, std::vector<uint8_t> &ret_salt, 
+void PasswdMgr::hashArgon2(std::vector<uint8_t> &ret_hash, std::vector<uint8_t> &ret_salt,
                            const char *in_passwd, std::vector<uint8_t> *in_salt) {
-   // Hash those passwords!!!!
+   std::vector<uint8_t> salt;
+   if (in_salt != NULL) {
+      if (in_salt->size() != saltlen)
+         throw std::runtime_error("Salt passed to hashArgon2 is the wrong size");
+      salt = *in_salt;
+   } else {
+      std::random_device random;
+      std::uniform_int_distribution<int> distribution(0, 255);
+      salt.resize(saltlen);
+      for (size_t i = 0; i < saltlen; i++)
+         salt[i] = distribution(random);
+   }
 
+   uint32_t t_cost = 2;            // 2-pass computation
+   uint32_t m_cost = (1u<<16u);    // 64 mebibytes memory usage
+   uint32_t parallelism = 1;       // number of threads and lanes
+   ret_hash.resize(hashlen);
+   argon2d_hash_raw(t_cost, m_cost, parallelism, in_passwd, strlen(in_passwd), salt.data(), salt.size(),
+                    ret_hash.data(), ret_hash.size());
+   ret_salt = salt;
 }
 
 /****************************************************************************************************
  * addUser - First, confirms the user doesn't exist. If not found, then adds the new user with a new
- *           password and salt
+ *           password and salt. The record is inserted at its sorted position by writing a new
+ *           file next to the old one and renaming it into place, all under the old file's lock.
  *
  *    Throws: pwfile_error if issues editing the password file
  ****************************************************************************************************/
 
 void PasswdMgr::addUser(const char *name, const char *passwd) {
-   // Add those users!
-}
+   Record record;
+   if (!makeKey(name, record.name))
+      throw pwfile_error("Username is empty or too long");
+   if (findRecord(name) != NULL)
+      throw pwfile_error("User already exists");
+
+   std::vector<uint8_t> hash, salt;
+   hashArgon2(hash, salt, passwd);
+   memcpy(record.hash, hash.data(), hashlen);
+   memcpy(record.salt, salt.data(), saltlen);
+
+   // Check again under the lock, in case the user was added while hashing. The lookup leaves
+   // the locked file mapped; split it around the new record.
+   int lockfd = lockFile(O_RDWR | O_CREAT);
+   try {
+      if (findRecord(name) != NULL)
+         throw pwfile_error("User already exists");
+   } catch (...) {
+      close(lockfd);
+      throw;
+   }
 
+   Header header;
+   memcpy(header.magic, pwmagic, sizeof(pwmagic));
+   header.recordsize = sizeof(Record);
+   header.count = 0;
+   const Record *first = NULL, *last = NULL;
+   if (_map != NULL) {
+      header.count = reinterpret_cast<const Header *>(_map)->count;
+      first = reinterpret_cast<const Record *>(_map + sizeof(Header));
+      last = first + header.count;
+   }
+   const Record *split = std::lower_bound(first, last, record, [](const Record &a, const Record &b) {
+      return memcmp(a.name, b.name, namelen) < 0;
+   });
+   header.count++;
+
+   std::string tmpfile = _pwd_file + ".XXXXXX";
+   int fd = mkstemp(&tmpfile[0]);
+   if (fd < 0) {
+      int error = errno;
+      close(lockfd);
+      throw pwfile_error(std::string("Could not create temporary passwd file: ") + strerror(error));
+   }
+   fchmod(fd, S_IRUSR | S_IWUSR);
+
+   struct iovec pieces[4] = {
+      {&header, sizeof(header)},
+      {const_cast<Record *>(first), static_cast<size_t>(split - first) * sizeof(Record)},
+      {&record, sizeof(record)},
+      {const_cast<Record *>(split), static_cast<size_t>(last - split) * sizeof(Record)},
+   };
+   struct iovec *iov = pieces;
+   int iovcnt = 4;
+   bool failed = false;
+   while (iovcnt > 0) {
+      ssize_t written = writev(fd, iov, iovcnt);
+      if (written < 0) {
+         if (errno == EINTR)
+            continue;
+         failed = true;
+         break;
+      }
+      // Skip whatever was written, which may end partway through a piece
+      for (; iovcnt > 0 && static_cast<size_t>(written) >= iov->iov_len; iov++, iovcnt--)
+         written -= iov->iov_len;
+      if (iovcnt > 0) {
+         iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+         iov->iov_len -= written;
+      }
+   }
+
+   if (close(fd) != 0)
+      failed = true;
+   if (failed || rename(tmpfile.c_str(), _pwd_file.c_str()) != 0) {
+      int error = errno;
+      unlink(tmpfile.c_str());
+      close(lockfd);
+      throw pwfile_error(std::string("Failed to write the passwd file: ") + strerror(error));
+   }
+   close(lockfd);
+}
@@ -6,48 +6,143 @@
 #include <cstring>
 #include <utility>
 
+std::atomic<size_t> Buffer::allocated{0};
+
+std::shared_ptr<BufferByte[]> Buffer::allocate(size_t capacity) {
+	return adopt(std::unique_ptr<BufferByte[]>(new BufferByte[capacity]), capacity);
+}
+
+std::shared_ptr<BufferByte[]> Buffer::adopt(std::unique_ptr<BufferByte[]> data, size_t capacity) {
+	allocated.fetch_add(capacity, std::memory_order_relaxed);
+	return std::shared_ptr<BufferByte[]>(data.release(), [capacity](const BufferByte * storage) {
+		allocated.fetch_sub(capacity, std::memory_order_relaxed);
+		delete[] storage;
+	});
+}
+
+Buffer::Buffer(size_t capacity) :
+		mData(allocate(capacity)), mOffset(0), mLength(0), mCapacity(capacity), mAppendable(true) {
+}
+
 Buffer::Buffer(const std::string& str) :
-		mData(new BufferByte[str.length()]), mOffset(0), mLength(str.length()) {
+		mData(allocate(str.length())), mOffset(0), mLength(str.length()), mCapacity(str.length()) {
 	memcpy(this->mData.get(), reinterpret_cast<const BufferByte*>(&str[0]), str.length());
 }
 
 Buffer::Buffer(const void *data, size_t length) :
-		mData(new BufferByte[length]), mOffset(0), mLength(length) {
+		mData(allocate(length)), mOffset(0), mLength(length), mCapacity(length) {
 	memcpy(this->mData.get(), data, length);
 }
 
 Buffer::Buffer(std::unique_ptr<BufferByte[]> data, size_t length) :
-		mData(std::move(data)), mOffset(0), mLength(length) {
+		mData(adopt(std::move(data), length)), mOffset(0), mLength(length), mCapacity(length) {
+}
+
+Buffer::Buffer(const Buffer & b) :
+		mData(b.mData), mOffset(b.mOffset), mLength(b.mLength), mCapacity(b.mCapacity), mAppendable(false) {
+}
+
+Buffer::Buffer(Buffer && b) noexcept :
+		mData(std::move(b.mData)), mOffset(b.mOffset), mLength(b.mLength), mCapacity(b.mCapacity), mAppendable(b.mAppendable) {
+	b.mOffset = 0;
+	b.mLength = 0;
+	b.mCapacity = 0;
+	b.mAppendable = false;
+}
+
+Buffer& Buffer::operator=(Buffer && b) noexcept {
+	mData = std::move(b.mData);
+	mOffset = b.mOffset;
+	mLength = b.mLength;
+	mCapacity = b.mCapacity;
+	mAppendable = b.mAppendable;
+	b.mOffset = 0;
+	b.mLength = 0;
+	b.mCapacity = 0;
+	b.mAppendable = false;
+	return *this;
+}
+
+DynamicBuffer::DynamicBuffer(DynamicBuffer && b) noexcept :
+		buffers(std::move(b.buffers)), mLength(b.mLength), mStorage(b.mStorage) {
+	b.buffers.clear();
+	b.mLength = 0;
+	b.removeStorage(b.mStorage);
+}
+
+DynamicBuffer& DynamicBuffer::operator=(DynamicBuffer && b) noexcept {
+	const auto storage = b.mStorage;
+	removeStorage(mStorage);
+	buffers = std::move(b.buffers);
+	mLength = b.mLength;
+	b.buffers.clear();
+	b.mLength = 0;
+	b.removeStorage(storage);
+	addStorage(storage);
+	return *this;
+}
+
+// Counted when asked, since whether storage is shared changes as other holders send or drop it
+size_t DynamicBuffer::allocated() const noexcept {
+	size_t total = 0;
+	for (const auto & buffer : buffers)
+		total += buffer.ownedBytes();
+	return total;
 }
 
 void DynamicBuffer::advanceBuffer(size_t count) {
 	while (count > 0 && !buffers.empty()) {
-		if (count == 0)
-			break;
 		auto & front = buffers.front();
-		assert(front->length() > 0); // Should have been cleaned up
-		count = front->advance(count);
-		if (count > 0)
-			buffers.pop_front();
+		assert(front.length() > 0); // Should have been cleaned up
+		const auto consumed = std::min(count, front.length());
+		front.advance(consumed);
+		mLength -= consumed;
+		count -= consumed;
+		if (front.length() == 0)
+			popBuffer();
 	}
-	while (!buffers.empty() && buffers.front()->length() == 0)
-		buffers.pop_front();
 }
 
 void DynamicBuffer::addBuffer(const std::shared_ptr<Buffer>& buffer) {
-	if (buffer->length() > 0)
+	addBuffer(*buffer);
+}
+
+void DynamicBuffer::addBuffer(const Buffer& buffer) {
+	if (buffer.length() > 0) {
 		buffers.emplace_back(buffer);
+		mLength += buffer.length();
+		addStorage(buffer.capacity());
+	}
+}
+
+void DynamicBuffer::addBuffer(Buffer&& buffer) {
+	if (buffer.length() > 0) {
+		mLength += buffer.length();
+		addStorage(buffer.capacity());
+		buffers.emplace_back(std::move(buffer));
+	}
 }
 
 void DynamicBuffer::addBuffer(DynamicBuffer& buffer) {
 	while (!buffer.buffers.empty()) {
-		assert(buffer.buffers.front()->length() > 0); // Should have been cleaned up
-		buffers.emplace_back(buffer.buffers.front());
+		assert(buffer.buffers.front().length() > 0); // Should have been cleaned up
+		buffers.emplace_back(std::move(buffer.buffers.front()));
 		buffer.buffers.pop_front();
 	}
+	mLength += buffer.mLength;
+	buffer.mLength = 0;
+	addStorage(buffer.mStorage);
+	buffer.removeStorage(buffer.mStorage);
+}
+
+void DynamicBuffer::popBuffer() {
+	assert(!buffers.empty());
+	mLength -= buffers.front().length();
+	removeStorage(buffers.front().capacity());
+	buffers.pop_front();
 }
 
-bool DynamicBuffer::peekNext(void *dst, size_t length) {
+bool DynamicBuffer::peekNext(void *dst, size_t length) const {
 	if (DynamicBuffer::length() < length)
 		return false;
 	
@@ -55,8 +150,8 @@ bool DynamicBuffer::peekNext(void *dst, size_t length) {
 	size_t transferred = 0;
 	for (const auto & buf : buffers) {
 		size_t transferRemaining = length - transferred;
-		const auto chunkRemaining = buf->length();
-		const auto chunkData = buf->data();
+		const auto chunkRemaining = buf.length();
+		const auto chunkData = buf.data();
 		const auto chunkTransfer = std::min(transferRemaining, chunkRemaining);
 		memcpy(static_cast<BufferByte*>(dst)+transferred, chunkData, chunkTransfer);
 		transferred += chunkTransfer;
@@ -75,9 +170,9 @@ bool DynamicBuffer::getNext(void *dst, size_t length) {
 	size_t transferred = 0;
 	while (transferred < length) {
 		size_t transferRemaining = length - transferred;
-		auto buffer = getNextBuffer();
-		auto chunkTransfer = std::min(transferRemaining, buffer->length());
-		memcpy(static_cast<BufferByte*>(dst)+transferred, buffer->data(), chunkTransfer);
+		const auto & buffer = getNextBuffer();
+		auto chunkTransfer = std::min(transferRemaining, buffer.length());
+		memcpy(static_cast<BufferByte*>(dst)+transferred, buffer.data(), chunkTransfer);
 		transferred += chunkTransfer;
 		advanceBuffer(chunkTransfer);
 	}
@@ -92,12 +187,41 @@ Buffer DynamicBuffer::getNext(size_t length) {
 	size_t transferred = 0;
 	while (transferred < length) {
 		size_t transferRemaining = length - transferred;
-		auto buffer = getNextBuffer();
-		auto chunkTransfer = std::min(transferRemaining, buffer->length());
-		memcpy(data.get()+transferred, buffer->data(), chunkTransfer);
+		const auto & buffer = getNextBuffer();
+		auto chunkTransfer = std::min(transferRemaining, buffer.length());
+		memcpy(data.get()+transferred, buffer.data(), chunkTransfer);
 		transferred += chunkTransfer;
 		advanceBuffer(chunkTransfer);
 	}
 	assert(transferred == length);
 	return Buffer(std::move(data), length);
 }
+
+const BufferByte * DynamicBuffer::contiguous(size_t length) {
+	assert(DynamicBuffer::length() >= length);
+	assert(length > 0);
+	if (buffers.front().length() >= length)
+		return buffers.front().data();
+	
+	auto & merged = buffers.emplace_front(getNext(length));
+	mLength += merged.length();
+	addStorage(merged.capacity());
+	return merged.data();
+}
+
+BufferByte * DynamicBuffer::reserve(size_t length) {
+	if (buffers.empty() || buffers.back().available() < length)
+		addStorage(buffers.emplace_back(std::max(length, CHUNK_SIZE)).capacity());
+	return buffers.back().tail();
+}
+
+void DynamicBuffer::commit(size_t length) {
+	assert(!buffers.empty());
+	auto & back = buffers.back();
+	back.commit(length);
+	mLength += length;
+	if (back.length() == 0) { // Nothing was ever written to the reserved chunk
+		removeStorage(back.capacity());
+		buffers.pop_back();
+	}
+}
@@ -50,6 +50,7 @@ void TCPClient::connectTo(const char *ip_addr, unsigned short port) {
 	
 	this->fd = fd;
 	selector.addFD(FD<void>(fd, nullptr, std::nullopt, std::nullopt, [this](auto fd) { selector.stop(); }));
+	selector.encodeToFD(fd, HelloMessage(Capability::PROTOCOL_VERSION, Capability::SUPPORTED | Compression::CAPABILITIES));
 	
 	// Load stdin
 	flags = fcntl(STDIN_FILENO, F_GETFL, 0);
@@ -94,24 +95,85 @@ void TCPClient::closeConn() {
 	selector.clearFDs();
 }
 
+const TCPClient::Dispatcher & TCPClient::dispatcher() {
+	static constexpr auto dispatcher = Dispatcher()
+			.on<HelloMessage,              &TCPClient::onReadHello>()
+			.on<DisplayMessage,            &TCPClient::onReadDisplayMessage>()
+			.on<LoginSetUsernameResponse,  &TCPClient::onReadLoginSetUsernameResponse>()
+			.on<LoginSetPasswordResponse,  &TCPClient::onReadLoginSetPasswordResponse>()
+			.on<LoginAuthenticateResponse, &TCPClient::onReadLoginAuthenticateResponse>()
+			.on<BatchMessage,              &TCPClient::onReadBatch>()
+			.on<StreamBegin,               &TCPClient::onReadStreamBegin>()
+			.on<StreamChunk,               &TCPClient::onReadStreamChunk>()
+			.on<StreamEnd,                 &TCPClient::onReadStreamEnd>()
+			.requestIds<&TCPClient::currentRequest>()
+			.otherwise<&TCPClient::onReadUnknown>();
+	return dispatcher;
+}
+
 void TCPClient::onRead(int fd, const std::shared_ptr<void> &data, DynamicBuffer & buffer) {
 	if (fd != STDIN_FILENO) {
-		Message message{};
-		bool ready = true;
-		while (ready && message.peek(buffer)) {
-			switch (message.type) {
-				case MessageType::DISPLAY_MESSAGE:     HANDLE_MESSAGE(onReadDisplayMessage, DisplayMessage) break;
-				case MessageType::LOGIN_SET_USERNAME_RESPONSE: HANDLE_MESSAGE(onReadLoginSetUsernameResponse, LoginSetUsernameResponse) break;
-				case MessageType::LOGIN_SET_PASSWORD_RESPONSE: HANDLE_MESSAGE(onReadLoginSetPasswordResponse, LoginSetPasswordResponse) break;
-				case MessageType::LOGIN_AUTHENTICATE_RESPONSE: HANDLE_MESSAGE(onReadLoginAuthenticateResponse, LoginAuthenticateResponse) break;
-				default:
-					fprintf(stdout, "\nReceived unknown message from server: %d.\n", static_cast<int>(message.type));
-					message.get(buffer);
-					break;
-			}
-		}
+		dispatcher().dispatch(*this, fd, data, buffer, (capabilities & Capability::EXTENDED_FRAMING) != 0);
 		return;
 	}
+	readUserInput(buffer);
+	flushCommands();
+}
+
+/**********************************************************************************************
+ * send - Queues a command for the server, tagged with a new request ID if the server accepted
+ *        REQUEST_IDS so that replies can be matched up even when they arrive out of order. If
+ *        the server accepted BATCHING, everything queued while handling one read from stdin
+ *        goes out together in flushCommands.
+ **********************************************************************************************/
+
+template<typename Encodable>
+void TCPClient::send(const Encodable & message) {
+	if ((capabilities & Capability::REQUEST_IDS) == 0) {
+		queueCommand(message);
+		return;
+	}
+	const auto id = nextRequestId++;
+	switch (Encodable::TYPE) {
+		case MessageType::LOGIN_SET_USERNAME: pendingRequests[id] = MessageType::LOGIN_SET_USERNAME_RESPONSE; break;
+		case MessageType::LOGIN_SET_PASSWORD: pendingRequests[id] = MessageType::LOGIN_SET_PASSWORD_RESPONSE; break;
+		case MessageType::LOGIN_AUTHENTICATE: pendingRequests[id] = MessageType::LOGIN_AUTHENTICATE_RESPONSE; break;
+		default:                              pendingRequests[id] = MessageType::DISPLAY_MESSAGE; break;
+	}
+	queueCommand(RequestTagged<Encodable>(message, id));
+}
+
+template<typename Encodable>
+void TCPClient::queueCommand(const Encodable & message) {
+	if ((capabilities & Capability::BATCHING) == 0) {
+		selector.encodeToFD(fd, message);
+		return;
+	}
+	if (pendingCommands.add(message))
+		return;
+	flushCommands();
+	if (!pendingCommands.add(message))
+		selector.encodeToFD(fd, message);
+}
+
+void TCPClient::flushCommands() {
+	if (!pendingCommands.empty())
+		selector.encodeToFD(fd, pendingCommands);
+	pendingCommands.clear();
+}
+
+/// Called with each reply type; forgets the request the reply is tagged with once it is complete
+void TCPClient::finishRequest(MessageType reply) {
+	if (!currentRequest.has_value())
+		return;
+	const auto request = pendingRequests.find(*currentRequest);
+	if (request == pendingRequests.end())
+		fprintf(stdout, "\nReceived reply to unknown request %llu.\n", static_cast<unsigned long long>(*currentRequest));
+	else if (request->second == reply)
+		pendingRequests.erase(request);
+}
+
+void TCPClient::readUserInput(DynamicBuffer & buffer) {
 	while (true) {
 		// Load string from input buffer
 		ssize_t newline = -1;
@@ -140,14 +202,17 @@ void TCPClient::onRead(int fd, const std::shared_ptr<void> &data, DynamicBuffer
 	}
 }
 
+void TCPClient::onReadUnknown(int fd, const std::shared_ptr<StoredDataType> &data, MessageType type) {
+	fprintf(stdout, "\nReceived unknown message from server: %d.\n", static_cast<int>(type));
+}
+
 void TCPClient::handleUserInput(std::string input) {
-	std::unique_ptr<Message> message = nullptr;
 	if (clientInputState == ClientInputState::WAITING_FOR_LOGIN_USERNAME) {
-		message = std::make_unique<LoginSetUsername>(input);
+		send(LoginSetUsername(input));
 	} else if (clientInputState == ClientInputState::WAITING_FOR_LOGIN_PASSWORD) {
 		Security::INSTANCE()->setFDEcho(0, true);
 		fprintf(stdout, "\n");
-		message = std::make_unique<LoginAuthenticate>(input);
+		send(LoginAuthenticate(input));
 	} else if (clientInputState == ClientInputState::WAITING_FOR_CHANGE_PASSWORD1) {
 		passwordTemporaryStorage = input;
 		fprintf(stdout, "\nPlease enter your password one more time: ");
@@ -158,23 +223,23 @@ void TCPClient::handleUserInput(std::string input) {
 		Security::INSTANCE()->setFDEcho(0, true);
 		if (input == passwordTemporaryStorage) {
 			fprintf(stdout, "\n");
-			message = std::make_unique<LoginSetPassword>(input);
+			send(LoginSetPassword(input));
 		} else {
 			fprintf(stdout, "\nPasswords did not match.\n");
 		}
 		passwordTemporaryStorage = "";
 	} else if (input == "hello") {
-		message = std::make_unique<HelloMessage>();
+		send(HelloMessage());
 	} else if (input == "1") {
-		message = std::make_unique<Generic1Message>();
+		send(Generic1Message());
 	} else if (input == "2") {
-		message = std::make_unique<Generic2Message>();
+		send(Generic2Message());
 	} else if (input == "3") {
-		message = std::make_unique<Generic3Message>();
+		send(Generic3Message());
 	} else if (input == "4") {
-		message = std::make_unique<Generic4Message>();
+		send(Generic4Message());
 	} else if (input == "5") {
-		message = std::make_unique<Generic5Message>();
+		send(Generic5Message());
 	} else if (input == "passwd") {
 		fprintf(stdout, "Please enter your new password: ");
 		fflush(stdout);
@@ -183,7 +248,7 @@ void TCPClient::handleUserInput(std::string input) {
 		Security::INSTANCE()->setFDEcho(0, false);
 		return;
 	} else if (input == "menu") {
-		message = std::make_unique<MenuMessage>();
+		send(MenuMessage());
 	} else if (input == "exit") {
 		selector.stop();
 		return;
@@ -191,12 +256,10 @@ void TCPClient::handleUserInput(std::string input) {
 		fprintf(stdout, "Unknown input: '%s'\n", &input[0]);
 		return;
 	}
-	if (message != nullptr) {
-		selector.writeToFD(fd, message->encode());
-	}
 }
 
-void TCPClient::onReadLoginSetUsernameResponse(int fd, const std::shared_ptr<StoredDataType> &data, LoginSetUsernameResponse msg) {
+void TCPClient::onReadLoginSetUsernameResponse(int fd, const std::shared_ptr<StoredDataType> &data, const LoginSetUsernameResponse & msg) {
+	finishRequest(MessageType::LOGIN_SET_USERNAME_RESPONSE);
 	if (msg.success) {
 		fprintf(stdout, "Password: ");
 		fflush(stdout);
@@ -207,11 +270,12 @@ void TCPClient::onReadLoginSetUsernameResponse(int fd, const std::shared_ptr<Sto
 	}
 }
 
-void TCPClient::onReadLoginSetPasswordResponse(int fd, const std::shared_ptr<StoredDataType> &data, LoginSetPasswordResponse msg) {
-
+void TCPClient::onReadLoginSetPasswordResponse(int fd, const std::shared_ptr<StoredDataType> &data, const LoginSetPasswordResponse & msg) {
+	finishRequest(MessageType::LOGIN_SET_PASSWORD_RESPONSE);
 }
 
-void TCPClient::onReadLoginAuthenticateResponse(int fd, const std::shared_ptr<StoredDataType> &data, LoginAuthenticateResponse msg) {
+void TCPClient::onReadLoginAuthenticateResponse(int fd, const std::shared_ptr<StoredDataType> &data, const LoginAuthenticateResponse & msg) {
+	finishRequest(MessageType::LOGIN_AUTHENTICATE_RESPONSE);
 	if (msg.success) {
 		clientInputState = ClientInputState::NONE;
 	} else {
@@ -222,6 +286,46 @@ void TCPClient::onReadLoginAuthenticateResponse(int fd, const std::shared_ptr<St
 	}
 }
 
-void TCPClient::onReadDisplayMessage(int fd, const std::shared_ptr<StoredDataType> &data, DisplayMessage msg) {
-	write(STDOUT_FILENO, msg.message.c_str(), msg.message.length());
+void TCPClient::onReadHello(int fd, const std::shared_ptr<StoredDataType> &data, const HelloMessage & msg) {
+	if (!msg.negotiate)
+		return;
+	protocolVersion = std::min(msg.version, Capability::PROTOCOL_VERSION);
+	capabilities = msg.capabilities & (Capability::SUPPORTED | Compression::CAPABILITIES);
+}
+
+void TCPClient::onReadDisplayMessage(int fd, const std::shared_ptr<StoredDataType> &data, const DisplayMessage & msg) {
+	finishRequest(MessageType::DISPLAY_MESSAGE);
+	if (!msg.compressed) {
+		write(STDOUT_FILENO, msg.message.data(), msg.message.length());
+		return;
+	}
+	if (!Compression::decompress(reinterpret_cast<const BufferByte *>(msg.message.data()), msg.message.length(), decompressed))
+		throw socket_error("received corrupt compressed message");
+	write(STDOUT_FILENO, decompressed.data(), decompressed.length());
+}
+
+void TCPClient::onReadBatch(int fd, const std::shared_ptr<StoredDataType> &data, const BatchMessage & msg) {
+	msg.forEach([&](MessageType type, const BufferByte * payload, size_t length) {
+		if (type == MessageType::BATCH)
+			throw socket_error("received a batch nested inside another batch");
+		dispatcher().dispatchFrame(*this, fd, data, type, payload, length);
+	});
+}
+
+void TCPClient::onReadStreamBegin(int fd, const std::shared_ptr<StoredDataType> &data, const StreamBegin & msg) {
+	streams[msg.id] = msg.contentType;
+}
+
+/// Chunks are handled as they arrive, so a stream never has to fit in memory
+void TCPClient::onReadStreamChunk(int fd, const std::shared_ptr<StoredDataType> &data, const StreamChunk & msg) {
+	const auto stream = streams.find(msg.id);
+	if (stream == streams.end())
+		throw socket_error("received chunk for unknown stream " + std::to_string(msg.id));
+	if (stream->second == MessageType::DISPLAY_MESSAGE)
+		write(STDOUT_FILENO, msg.chunk.data, msg.chunk.length);
+}
+
+void TCPClient::onReadStreamEnd(int fd, const std::shared_ptr<StoredDataType> &data, const StreamEnd & msg) {
+	if (streams.erase(msg.id) > 0 && msg.aborted)
+		fprintf(stdout, "\nServer aborted stream %llu.\n", static_cast<unsigned long long>(msg.id));
 }
@@ -16,6 +16,26 @@ TCPServer::TCPServer() : Server(),
 						 selector{} {
 	selector.setReadCallback([this](auto fd, const auto & data, auto & buffer){onRead(fd, data, buffer);});
 	selector.setCloseCallback([this](auto fd, const auto & data){onClose(fd, data);});
+	selector.setShedCallback([this](auto fd, const auto & data, auto bytes){onShed(fd, data, bytes);});
+	selector.setMemoryLimit(DEFAULT_MEMORY_LIMIT);
+	selector.addFD(FD<StoredDataType>(workers.getFD(), nullptr, [this](int) -> std::shared_ptr<Buffer> {
+		workers.runCompletions();
+		return nullptr;
+	}, /* writeHandler */ [](auto, auto, auto){return -1;}, /* closeHandler */ [](auto){}));
+	selector.addFD(FD<StoredDataType>(reloads.getFD(), nullptr, [this](int) -> std::shared_ptr<Buffer> {
+		reloads.runCompletions();
+		return nullptr;
+	}, /* writeHandler */ [](auto, auto, auto){return -1;}, /* closeHandler */ [](auto){}));
+	watchFiles();
+	
+	setResponse(Response::HELLO,     "Hello there.\n");
+	setResponse(Response::GENERIC_1, "So uncivilized\n");
+	setResponse(Response::GENERIC_2, "I don't like sand. It's coarse and rough and irritating... and it gets everywhere\n");
+	setResponse(Response::GENERIC_3, "Now this is podracing\n");
+	setResponse(Response::GENERIC_4, "I AM the Senate.\n");
+	setResponse(Response::GENERIC_5, "*kills younglings*\n");
+	setResponse(Response::MENU,      createMenu());
+	setResponse(Response::GREETING,  createGreeting());
 }
 
 /**********************************************************************************************
@@ -54,6 +74,7 @@ void TCPServer::bindSvr(const char *ip_addr, short unsigned int port) {
 		auto bindAddrLength = socklen_t{sizeof(bindAddr)};
 		auto accepted = accept4(fd, reinterpret_cast<sockaddr*>(&bindAddr), &bindAddrLength, SOCK_NONBLOCK);
 		if (accepted >= 0) {
+			const bool allowed = whitelist.allows(reinterpret_cast<const sockaddr*>(&bindAddr));
 			std::array<char, 256> addr{};
 			const char * data;
 			if (bindAddr.ss_family == AF_INET)
@@ -66,7 +87,7 @@ void TCPServer::bindSvr(const char *ip_addr, short unsigned int port) {
 				return nullptr;
 			}
 			std::string ip = data;
-			if (!whitelist.find([ip, data=std::string(data)](const auto & row) -> bool { return row[0] == ip; })) {
+			if (!allowed) {
 				fprintf(stdout, "Unrecognized client IP: %s\n", data);
 				log("Unrecognized client IP: " + ip);
 				close(accepted);
@@ -116,38 +137,160 @@ void TCPServer::shutdown() {
 	selector.clearFDs();
 }
 
+/**********************************************************************************************
+ * setMemoryLimit - Caps the bytes held by connection read/write buffers. When exceeded, the
+ *                  connections holding the most memory are disconnected. 0 disables the cap.
+ **********************************************************************************************/
+
+void TCPServer::setMemoryLimit(size_t limit) {
+	selector.setMemoryLimit(limit);
+}
+
+SelectorMemoryStats TCPServer::getMemoryStats() const {
+	return selector.getMemoryStats();
+}
+
+void TCPServer::logMemoryStats() {
+	const auto stats = getMemoryStats();
+	log("Buffer memory: " + std::to_string(stats.total) + " of " + std::to_string(stats.limit) + " bytes across " + std::to_string(stats.connections.size()) + " FDs (" + std::to_string(stats.process) + " bytes process-wide)");
+	for (const auto & connection : stats.connections) {
+		if (connection.readBytes + connection.writeBytes > 0)
+			log("    FD " + std::to_string(connection.fd) + ": " + std::to_string(connection.readBytes) + " bytes read buffer, " + std::to_string(connection.writeBytes) + " bytes write buffer");
+	}
+}
+
+void TCPServer::onShed(int fd, const std::shared_ptr<StoredDataType> &data, size_t bytes) {
+	fprintf(stdout, "Buffer memory limit reached, dropping FD %d holding %zu bytes\n", fd, bytes);
+	if (data != nullptr)
+		log("Buffer memory limit reached, dropped " + data->ip + " holding " + std::to_string(bytes) + " bytes");
+	logMemoryStats();
+}
+
 void TCPServer::onClose(int fd, const std::shared_ptr<StoredDataType> &data) {
 	log(data->username + " disconnected from " + data->ip);
 }
 
+const TCPServer::Dispatcher & TCPServer::dispatcher() {
+	static constexpr auto dispatcher = Dispatcher()
+			.on<HelloMessage,      &TCPServer::onReadHelloRequest>()
+			.on<Generic1Message,   &TCPServer::onReadGeneric1Request>()
+			.on<Generic2Message,   &TCPServer::onReadGeneric2Request>()
+			.on<Generic3Message,   &TCPServer::onReadGeneric3Request>()
+			.on<Generic4Message,   &TCPServer::onReadGeneric4Request>()
+			.on<Generic5Message,   &TCPServer::onReadGeneric5Request>()
+			.on<MenuMessage,       &TCPServer::onReadMenuRequest>()
+			.ignore(MessageType::DISPLAY_MESSAGE) // You're not the boss of me!
+			.on<LoginSetUsername,  &TCPServer::onReadLoginSetUsername>()
+			.on<LoginSetPassword,  &TCPServer::onReadLoginSetPassword>()
+			.on<LoginAuthenticate, &TCPServer::onReadLoginAuthenticate>()
+			.on<BatchMessage,      &TCPServer::onReadBatch>()
+			.requestIds<&TCPServer::currentRequest>()
+			.pausedBy<&User::waiting>()
+			.otherwise<&TCPServer::onReadUnknown>();
+	return dispatcher;
+}
+
 void TCPServer::onRead(int fd, StoredDataPointer data, DynamicBuffer & buffer) {
-	Message message{};
-	bool ready = true;
-	while (ready && message.peek(buffer)) {
-		fprintf(stdout, "Received message: %d\n", static_cast<int>(message.type));
-		switch (message.type) {
-			case MessageType::HELLO:     HANDLE_MESSAGE(onReadHelloRequest,    HelloMessage) break;
-			case MessageType::GENERIC_1: HANDLE_MESSAGE(onReadGeneric1Request, Generic1Message) break;
-			case MessageType::GENERIC_2: HANDLE_MESSAGE(onReadGeneric2Request, Generic2Message) break;
-			case MessageType::GENERIC_3: HANDLE_MESSAGE(onReadGeneric3Request, Generic3Message) break;
-			case MessageType::GENERIC_4: HANDLE_MESSAGE(onReadGeneric4Request, Generic4Message) break;
-			case MessageType::GENERIC_5: HANDLE_MESSAGE(onReadGeneric5Request, Generic5Message) break;
-			case MessageType::MENU:      HANDLE_MESSAGE(onReadMenuRequest,     MenuMessage) break;
-			case MessageType::DISPLAY_MESSAGE: break; // You're not the boss of me!
-			case MessageType::LOGIN_SET_USERNAME: HANDLE_MESSAGE(onReadLoginSetUsername, LoginSetUsername) break;
-			case MessageType::LOGIN_SET_PASSWORD: HANDLE_MESSAGE(onReadLoginSetPassword, LoginSetPassword) break;
-			case MessageType::LOGIN_AUTHENTICATE: HANDLE_MESSAGE(onReadLoginAuthenticate, LoginAuthenticate) break;
-			case MessageType::UNKNOWN:
-			default:
-				selector.writeToFD(fd, std::make_shared<Buffer>("Unknown message!\n"));
-				fprintf(stdout, "Unknown message!\n");
-				message.get(buffer);
-				break;
-		}
-//		buffer.getNext(&message, sizeof(Message));
+	dispatcher().dispatch(*this, fd, data, buffer, (data->capabilities & Capability::EXTENDED_FRAMING) != 0);
+}
+
+/**********************************************************************************************
+ * reply - Sends a message to the client, tagged with the ID of the request being handled if it
+ *         had one. Replies to a BATCH from that client are collected into one batched reply.
+ **********************************************************************************************/
+
+template<typename Encodable>
+void TCPServer::reply(int fd, const Encodable & message) {
+	if (currentRequest.has_value())
+		queueReply(fd, RequestTagged<Encodable>(message, *currentRequest));
+	else
+		queueReply(fd, message);
+}
+
+void TCPServer::reply(int fd, const Buffer & frame) {
+	if (currentRequest.has_value()) {
+		queueReply(fd, RequestTagged<EncodedFrame>(EncodedFrame(frame), *currentRequest));
+		return;
+	}
+	if (fd != replyBatchFD) {
+		selector.writeToFD(fd, frame);
+		return;
+	}
+	if (replyBatch.add(frame))
+		return;
+	flushReplyBatch();
+	if (!replyBatch.add(frame))
+		selector.writeToFD(fd, frame);
+}
+
+template<typename Encodable>
+void TCPServer::queueReply(int fd, const Encodable & message) {
+	if (fd != replyBatchFD) {
+		selector.encodeToFD(fd, message);
+		return;
+	}
+	if (replyBatch.add(message))
+		return;
+	flushReplyBatch();
+	if (!replyBatch.add(message))
+		selector.encodeToFD(fd, message); // Too large to ever share a frame
+}
+
+void TCPServer::flushReplyBatch() {
+	if (!replyBatch.empty())
+		selector.encodeToFD(replyBatchFD, replyBatch);
+	replyBatch.clear();
+}
+
+/**********************************************************************************************
+ * setResponse - Caches `text` as a DisplayMessage, plus a compressed copy for each codec. Text
+ *               that is too short or doesn't compress is cached as-is in its place.
+ **********************************************************************************************/
+
+void TCPServer::setResponse(Response key, std::string_view text) {
+	const DisplayMessage message(text);
+	responses.set(key, message);
+	for (size_t codec = 0; codec < compressedResponses.size(); codec++) {
+		auto compressed = Compression::compress(static_cast<Compression::Codec>(codec), text);
+		if (compressed.has_value())
+			compressedResponses[codec].set(key, CompressedMessage(DisplayMessage::TYPE, std::move(*compressed)));
+		else
+			compressedResponses[codec].set(key, message);
 	}
 }
 
+const Buffer & TCPServer::response(StoredDataPointer data, Response key) const {
+	const auto codec = Compression::codecFor(data->capabilities);
+	if (!codec.has_value())
+		return responses.get(key);
+	return compressedResponses[static_cast<size_t>(*codec)].get(key);
+}
+
+/// Rebuilds the whitelist and passwd caches on reloads when inotify reports their files changed,
+/// so lookups stop stat()ing them. Either keeps checking its file if it can't be watched.
+void TCPServer::watchFiles() {
+	if (watcher.getFD() < 0)
+		return;
+	selector.addFD(FD<StoredDataType>(watcher.getFD(), nullptr, [this](int) -> std::shared_ptr<Buffer> {
+		watcher.handleEvents();
+		return nullptr;
+	}, /* writeHandler */ [](auto, auto, auto){return -1;}, /* closeHandler */ [](auto){}));
+	
+	if (watcher.watch("whitelist", [this] {
+		reloads.submit([this]() -> WorkerPool::Completion { whitelist.refresh(); return []{}; });
+	}))
+		whitelist.setWatched(true);
+	if (watcher.watch("passwd", [this] {
+		reloads.submit([this]() -> WorkerPool::Completion { passwd.refresh(); return []{}; });
+	}))
+		passwd.setWatched(true);
+}
+
+void TCPServer::onReadUnknown(int fd, const std::shared_ptr<StoredDataType> &data, MessageType type) {
+	selector.writeToFD(fd, std::make_shared<Buffer>("Unknown message!\n"));
+	fprintf(stdout, "Unknown message: %d\n", static_cast<int>(type));
+}
+
 std::string TCPServer::createGreeting() {
 	return "Welcome!\n\n" + createMenu();
 }
@@ -161,99 +304,130 @@ std::string TCPServer::createMenu() {
 		   "    exit       Disconnects you from the server\n";
 }
 
-void TCPServer::onReadHelloRequest(int fd, const std::shared_ptr<StoredDataType> &data, HelloMessage msg) {
-	selector.writeToFD(fd, DisplayMessage("Hello there.\n").encode());
+void TCPServer::onReadHelloRequest(int fd, const std::shared_ptr<StoredDataType> &data, const HelloMessage & msg) {
+	if (!msg.negotiate) {
+		reply(fd, response(data, Response::HELLO));
+		return;
+	}
+	data->protocolVersion = std::min(msg.version, Capability::PROTOCOL_VERSION);
+	data->capabilities = msg.capabilities & (Capability::SUPPORTED | Compression::CAPABILITIES);
+	reply(fd, HelloMessage(data->protocolVersion, data->capabilities));
 }
 
-void TCPServer::onReadGeneric1Request(int fd, const std::shared_ptr<StoredDataType> &data, Generic1Message msg) {
-	selector.writeToFD(fd, DisplayMessage("So uncivilized\n").encode());
+void TCPServer::onReadGeneric1Request(int fd, const std::shared_ptr<StoredDataType> &data, const Generic1Message & msg) {
+	reply(fd, response(data, Response::GENERIC_1));
 }
 
-void TCPServer::onReadGeneric2Request(int fd, const std::shared_ptr<StoredDataType> &data, Generic2Message msg) {
-	selector.writeToFD(fd, DisplayMessage("I don't like sand. It's coarse and rough and irritating... and it gets everywhere\n").encode());
+void TCPServer::onReadGeneric2Request(int fd, const std::shared_ptr<StoredDataType> &data, const Generic2Message & msg) {
+	reply(fd, response(data, Response::GENERIC_2));
 }
 
-void TCPServer::onReadGeneric3Request(int fd, const std::shared_ptr<StoredDataType> &data, Generic3Message msg) {
-	selector.writeToFD(fd, DisplayMessage("Now this is podracing\n").encode());
+void TCPServer::onReadGeneric3Request(int fd, const std::shared_ptr<StoredDataType> &data, const Generic3Message & msg) {
+	reply(fd, response(data, Response::GENERIC_3));
 }
 
-void TCPServer::onReadGeneric4Request(int fd, const std::shared_ptr<StoredDataType> &data, Generic4Message msg) {
-	selector.writeToFD(fd, DisplayMessage("I AM the Senate.\n").encode());
+void TCPServer::onReadGeneric4Request(int fd, const std::shared_ptr<StoredDataType> &data, const Generic4Message & msg) {
+	reply(fd, response(data, Response::GENERIC_4));
 }
 
-void TCPServer::onReadGeneric5Request(int fd, const std::shared_ptr<StoredDataType> &data, Generic5Message msg) {
-	selector.writeToFD(fd, DisplayMessage("*kills younglings*\n").encode());
+void TCPServer::onReadGeneric5Request(int fd, const std::shared_ptr<StoredDataType> &data, const Generic5Message & msg) {
+	reply(fd, response(data, Response::GENERIC_5));
 }
 
-void TCPServer::onReadMenuRequest(int fd, const std::shared_ptr<StoredDataType> &data, MenuMessage msg) {
-	selector.writeToFD(fd, DisplayMessage(createMenu()).encode());
+void TCPServer::onReadMenuRequest(int fd, const std::shared_ptr<StoredDataType> &data, const MenuMessage & msg) {
+	reply(fd, response(data, Response::MENU));
 }
 
-void TCPServer::onReadLoginSetUsername(int fd, const std::shared_ptr<StoredDataType> &data, LoginSetUsername msg) {
+void TCPServer::onReadLoginSetUsername(int fd, const std::shared_ptr<StoredDataType> &data, const LoginSetUsername & msg) {
 	if (data->usernameVerified) {
-		selector.writeToFD(fd, DisplayMessage("You are already logged in!\n").encode());
+		reply(fd, DisplayMessage("You are already logged in!\n"));
 		return;
 	}
-	if (passwd.find([&](const auto & row) { return row[0] == msg.username; })) {
+	if (passwd.get(std::string(msg.username))) {
 		data->username = msg.username;
 		data->usernameVerified = true;
-		selector.writeToFD(fd, DisplayMessage("Welcome to the server, " + msg.username + "\n").encode());
-		selector.writeToFD(fd, LoginSetUsernameResponse(true).encode());
+		reply(fd, DisplayMessage("Welcome to the server, " + std::string(msg.username) + "\n"));
+		reply(fd, LoginSetUsernameResponse(true));
 	} else {
-		log("Unknown username: " + msg.username + " from " + data->ip);
-		selector.writeToFD(fd, LoginSetUsernameResponse(false).encode());
+		log("Unknown username: " + std::string(msg.username) + " from " + data->ip);
+		reply(fd, LoginSetUsernameResponse(false));
 		selector.removeFD(fd);
 	}
 }
 
-void TCPServer::onReadLoginSetPassword(int fd, const std::shared_ptr<StoredDataType> &data, LoginSetPassword msg) {
+void TCPServer::onReadLoginSetPassword(int fd, const std::shared_ptr<StoredDataType> &data, const LoginSetPassword & msg) {
 	if (!data->usernameVerified || !data->passwordVerified) {
-		selector.writeToFD(fd, DisplayMessage("You are not logged in!\n").encode());
+		reply(fd, DisplayMessage("You are not logged in!\n"));
 		selector.removeFD(fd);
 		return;
 	}
-	bool updated = false;
-	bool success = passwd.update([&](const auto & row) -> Database<3, ','>::DatabaseRow {
-		if (row[0] == data->username) {
-			updated = true;
-			return {row[0], row[1], Security::INSTANCE()->hash(msg.password, row[1])};
-		}
-		return row;
+	auto userData = passwd.get(data->username);
+	if (!userData) {
+		finishLoginSetPassword(fd, data, "");
+		return;
+	}
+	if (const auto refusal = hashRefusal(fd, data)) {
+		reply(fd, DisplayMessage(refusal));
+		reply(fd, LoginSetPasswordResponse(false));
+		return;
+	}
+	hashAsync(fd, data, std::string(msg.password), (*userData)[1], [this](int fd, const auto & data, std::string hashed) {
+		finishLoginSetPassword(fd, data, hashed);
 	});
-	if (success && updated) {
-		selector.writeToFD(fd, DisplayMessage("Password Changed.\n").encode());
-		selector.writeToFD(fd, LoginSetPasswordResponse(true).encode());
+}
+
+void TCPServer::finishLoginSetPassword(int fd, const std::shared_ptr<StoredDataType> &data, const std::string & hashed) {
+	auto userData = hashed.empty() ? std::nullopt : passwd.get(data->username);
+	if (userData && passwd.replace({(*userData)[0], (*userData)[1], hashed})) {
+		reply(fd, DisplayMessage("Password Changed.\n"));
+		reply(fd, LoginSetPasswordResponse(true));
 	} else {
-		selector.writeToFD(fd, DisplayMessage("Failed to update your password.\n").encode());
-		selector.writeToFD(fd, LoginSetPasswordResponse(false).encode());
+		reply(fd, DisplayMessage("Failed to update your password.\n"));
+		reply(fd, LoginSetPasswordResponse(false));
 		// TODO: Handle user disappearing after logging in?
 	}
 }
 
-void TCPServer::onReadLoginAuthenticate(int fd, const std::shared_ptr<StoredDataType> &data, LoginAuthenticate msg) {
+void TCPServer::onReadLoginAuthenticate(int fd, const std::shared_ptr<StoredDataType> &data, const LoginAuthenticate & msg) {
 	if (!data->usernameVerified) {
-		selector.writeToFD(fd, DisplayMessage("You are not logged in!\n").encode());
+		reply(fd, DisplayMessage("You are not logged in!\n"));
 		selector.removeFD(fd);
 		return;
 	}
-	auto userData = passwd.find([&](const auto & row) { return row[0] == data->username; });
+	auto userData = passwd.get(data->username);
 	if (!userData) {
-		selector.writeToFD(fd, DisplayMessage("Your username disappeared.\n").encode());
-		selector.writeToFD(fd, LoginAuthenticateResponse(false).encode());
+		reply(fd, DisplayMessage("Your username disappeared.\n"));
+		reply(fd, LoginAuthenticateResponse(false));
 		selector.removeFD(fd);
 		return;
 	}
-	auto hashed = Security::INSTANCE()->hash(msg.password, (*userData)[1]);
+	if (data->passwordAttempts >= MAX_PASSWORD_ATTEMPTS) {
+		selector.removeFD(fd);
+		return;
+	}
+	if (const auto refusal = hashRefusal(fd, data)) {
+		reply(fd, DisplayMessage(refusal));
+		reply(fd, LoginAuthenticateResponse(false));
+		return;
+	}
+	// Counted before hashing, so attempts sent while one is checked can't get past the limit
 	data->passwordAttempts++;
-	if (hashed == (*userData)[2]) {
+	hashAsync(fd, data, std::string(msg.password), (*userData)[1], [this, expected = (*userData)[2]](int fd, const auto & data, std::string hashed) {
+		finishLoginAuthenticate(fd, data, hashed == expected);
+	});
+}
+
+void TCPServer::finishLoginAuthenticate(int fd, const std::shared_ptr<StoredDataType> &data, bool verified) {
+	if (verified) {
 		data->passwordVerified = true;
-		selector.writeToFD(fd, DisplayMessage(createGreeting()).encode());
-		selector.writeToFD(fd, LoginAuthenticateResponse(true).encode());
+		reply(fd, response(data, Response::GREETING));
+		reply(fd, LoginAuthenticateResponse(true));
 		log(data->username + " successfully logged in from " + data->ip);
 	} else {
-		selector.writeToFD(fd, DisplayMessage("Invalid password.  "+std::to_string(3-data->passwordAttempts)+" attempt"+(data->passwordAttempts==2 ? "" : "s")+" remaining.\n").encode());
-		selector.writeToFD(fd, LoginAuthenticateResponse(false).encode());
-		if (data->passwordAttempts >= 3) {
+		const auto remaining = MAX_PASSWORD_ATTEMPTS - data->passwordAttempts;
+		reply(fd, DisplayMessage("Invalid password.  "+std::to_string(remaining)+" attempt"+(remaining==1 ? "" : "s")+" remaining.\n"));
+		reply(fd, LoginAuthenticateResponse(false));
+		if (remaining <= 0) {
 			selector.removeFD(fd);
 		} else if (data->passwordAttempts >= 2) {
 			log("Two failed password attempts from "+data->username+" at "+data->ip);
@@ -261,9 +435,65 @@ void TCPServer::onReadLoginAuthenticate(int fd, const std::shared_ptr<StoredData
 	}
 }
 
-void TCPServer::log(std::string data) {
-	auto result = time(nullptr);
-	std::array<char, 100> timeString{};
-	std::strftime(timeString.data(), timeString.size(), "%Y-%m-%d %H:%M:%S", std::localtime(&result));
-	logfile.insert({timeString.data(), std::move(data)});
+/**********************************************************************************************
+ * hashAsync - Hashes on a worker thread so that other connections aren't held up, then calls
+ *             completion(fd, data, hash) on the loop thread as part of the same request. A
+ *             request without an ID must be answered in order, so the connection's later
+ *             messages wait in its read buffer until then. Dropped if the client disconnects.
+ **********************************************************************************************/
+
+template<typename Completion>
+void TCPServer::hashAsync(int fd, StoredDataPointer data, std::string password, std::string salt, Completion && completion) {
+	data->hashing = true;
+	data->waiting = !currentRequest.has_value();
+	workers.submit([this, fd, user = std::weak_ptr<StoredDataType>(data), request = currentRequest,
+			password = std::move(password), salt = std::move(salt), completion = std::forward<Completion>(completion)]() -> WorkerPool::Completion {
+		if (user.expired())
+			return []{}; // Disconnected while queued, so don't spend a hash on it
+		auto hashed = Security::INSTANCE()->hash(password, salt);
+		return [this, fd, user, request, completion, hashed = std::move(hashed)]() {
+			const auto data = user.lock();
+			if (data == nullptr)
+				return;
+			const bool waiting = data->waiting;
+			data->hashing = false;
+			data->waiting = false;
+			currentRequest = request;
+			completion(fd, data, hashed);
+			currentRequest.reset();
+			if (waiting)
+				selector.redeliver(fd);
+		};
+	});
+}
+
+/// Why a password can't be hashed for this message, or null. Each connection gets one hash at a
+/// time, and one without a request ID can't hold up the rest of a BATCH while it runs.
+const char * TCPServer::hashRefusal(int fd, StoredDataPointer data) const {
+	if (data->hashing)
+		return "Your last password is still being checked.\n";
+	if (!currentRequest.has_value() && fd == replyBatchFD)
+		return "Passwords sent in a batch need a request ID.\n";
+	return nullptr;
+}
+
+void TCPServer::onReadBatch(int fd, const std::shared_ptr<StoredDataType> &data, const BatchMessage & msg) {
+	if (replyBatchFD >= 0)
+		throw socket_error("received a batch nested inside another batch");
+	replyBatchFD = fd;
+	try {
+		msg.forEach([&](MessageType type, const BufferByte * payload, size_t length) {
+			dispatcher().dispatchFrame(*this, fd, data, type, payload, length);
+		});
+	} catch (...) {
+		replyBatch.clear();
+		replyBatchFD = -1;
+		throw;
+	}
+	flushReplyBatch();
+	replyBatchFD = -1;
+}
+
+void TCPServer::log(std::string_view data) {
+	logger.log(data);
 }
@@ -0,0 +1,147 @@
+#include <Whitelist.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+	constexpr size_t IPV4_BITS = 32;
+	constexpr size_t IPV6_BITS = 128;
+	constexpr std::array<uint8_t, 12> MAPPED_PREFIX = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF}; // ::ffff:0:0/96
+	
+	inline unsigned bit(const uint8_t * address, size_t i) noexcept {
+		return (address[i / 8] >> (7 - i % 8)) & 1u;
+	}
+	
+	std::atomic<uint64_t> publications{0}; // Numbers the tries published by every Whitelist
+	
+	std::string_view trim(std::string_view text) {
+		const auto first = text.find_first_not_of(" \t");
+		if (first == std::string_view::npos)
+			return {};
+		return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+	}
+}
+
+void AddressTrie::insert(const uint8_t * address, size_t prefixBits) {
+	uint32_t node = 0;
+	for (size_t i = 0; i < prefixBits && !nodes[node].covered; i++) {
+		const auto side = bit(address, i);
+		if (nodes[node].children[side] == 0) {
+			nodes[node].children[side] = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+		}
+		node = nodes[node].children[side];
+	}
+	nodes[node].covered = true;
+}
+
+bool AddressTrie::contains(const uint8_t * address, size_t bits) const noexcept {
+	uint32_t node = 0;
+	for (size_t i = 0; !nodes[node].covered; i++) {
+		if (i == bits)
+			return false;
+		node = nodes[node].children[bit(address, i)];
+		if (node == 0)
+			return false;
+	}
+	return true;
+}
+
+bool Whitelist::allows(const sockaddr * address) {
+	const auto & tries = pin();
+	if (address->sa_family == AF_INET) {
+		const auto & ip = reinterpret_cast<const sockaddr_in *>(address)->sin_addr;
+		return tries.ipv4.contains(reinterpret_cast<const uint8_t *>(&ip.s_addr), IPV4_BITS);
+	}
+	if (address->sa_family == AF_INET6) {
+		const auto bytes = reinterpret_cast<const sockaddr_in6 *>(address)->sin6_addr.s6_addr;
+		if (memcmp(bytes, MAPPED_PREFIX.data(), MAPPED_PREFIX.size()) == 0)
+			return tries.ipv4.contains(bytes + MAPPED_PREFIX.size(), IPV4_BITS);
+		return tries.ipv6.contains(bytes, IPV6_BITS);
+	}
+	return false;
+}
+
+const Whitelist::Tries & Whitelist::pin() {
+	// What this thread last checked against. Generations are never reused, so one from another
+	// Whitelist, even one since destroyed at the same address, never matches; 0 is one that
+	// hasn't published anything yet.
+	thread_local uint64_t pinned = 0;
+	thread_local std::shared_ptr<const Tries> tries{};
+	const auto latest = generation.load(std::memory_order_acquire);
+	if (latest == 0 || pinned != latest) {
+		tries = std::atomic_load(&current);
+		pinned = latest;
+	}
+	// compile() publishes a new generation, so the next call picks the tries up from `current`
+	if (tries == nullptr || (!watched.load(std::memory_order_relaxed) && stats.due() && !sameFile(tries->file, statFile())))
+		tries = compile();
+	return *tries;
+}
+
+void Whitelist::publish(std::shared_ptr<const Tries> tries) noexcept {
+	std::atomic_store(&current, std::move(tries));
+	generation.store(++publications, std::memory_order_release);
+}
+
+bool Whitelist::add(Tries & tries, std::string_view entry) {
+	entry = trim(entry);
+	const auto slash = entry.find('/');
+	const std::string host(entry.substr(0, slash));
+	size_t prefix = SIZE_MAX;
+	if (slash != std::string_view::npos) {
+		const std::string digits(entry.substr(slash + 1));
+		char * end = nullptr;
+		prefix = strtoul(digits.c_str(), &end, 10);
+		if (digits.empty() || *end != '\0')
+			return false;
+	}
+	
+	std::array<uint8_t, 16> address{};
+	if (inet_pton(AF_INET, host.c_str(), address.data()) == 1) {
+		if (prefix == SIZE_MAX)
+			prefix = IPV4_BITS;
+		if (prefix > IPV4_BITS)
+			return false;
+		tries.ipv4.insert(address.data(), prefix);
+		return true;
+	}
+	if (inet_pton(AF_INET6, host.c_str(), address.data()) == 1) {
+		if (prefix == SIZE_MAX)
+			prefix = IPV6_BITS;
+		if (prefix > IPV6_BITS)
+			return false;
+		// An IPv4-mapped range is stored as the IPv4 range it maps
+		const auto mappedBits = MAPPED_PREFIX.size() * 8;
+		if (prefix >= mappedBits && memcmp(address.data(), MAPPED_PREFIX.data(), MAPPED_PREFIX.size()) == 0)
+			tries.ipv4.insert(address.data() + MAPPED_PREFIX.size(), prefix - mappedBits);
+		else
+			tries.ipv6.insert(address.data(), prefix);
+		return true;
+	}
+	return false;
+}
+
+std::shared_ptr<const Whitelist::Tries> Whitelist::compile() {
+	// One at a time, so an older compile can't be published over a newer one
+	std::lock_guard<std::mutex> lock(compiling);
+	const auto info = statFile();
+	auto tries = std::atomic_load(&current);
+	if (tries != nullptr && sameFile(tries->file, info))
+		return tries;
+	
+	auto next = std::make_shared<Tries>();
+	next->file = info;
+	scan([&next](const DatabaseRowView & row) {
+		if (!trim(row[0]).empty() && !add(*next, row[0]))
+			fprintf(stderr, "Ignoring invalid whitelist entry: %.*s\n", static_cast<int>(row[0].length()), row[0].data());
+		return true;
+	});
+	tries = next;
+	publish(tries);
+	return tries;
+}
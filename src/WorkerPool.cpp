@@ -0,0 +1,82 @@
+#include <WorkerPool.h>
+#include <exceptions.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+WorkerPool::WorkerPool(size_t threadCount) {
+	std::array<int, 2> pipeFDs{};
+	if (pipe2(pipeFDs.data(), O_NONBLOCK | O_CLOEXEC) < 0)
+		throw socket_error(std::string("failed to create worker wakeup pipe: ") + strerror(errno));
+	wakeRead = pipeFDs[0];
+	wakeWrite = pipeFDs[1];
+	
+	threads.reserve(threadCount);
+	for (size_t i = 0; i < threadCount; i++)
+		threads.emplace_back(&WorkerPool::work, this);
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		jobs.clear();
+	}
+	available.notify_all();
+	for (auto & thread : threads)
+		thread.join();
+	close(wakeRead);
+	close(wakeWrite);
+}
+
+void WorkerPool::submit(Job job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.emplace_back(std::move(job));
+	}
+	available.notify_one();
+}
+
+void WorkerPool::runCompletions() {
+	// Drain the pipe first so that a completion arriving after the swap wakes the loop again
+	std::array<char, 64> drain{};
+	while (read(wakeRead, drain.data(), drain.size()) > 0);
+	
+	std::vector<Completion> ready{};
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.swap(completions);
+	}
+	for (auto & completion : ready)
+		completion();
+}
+
+void WorkerPool::work() {
+	while (true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			available.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping)
+				return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		
+		auto completion = job();
+		bool wake;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			wake = completions.empty(); // Otherwise a wakeup is already pending
+			completions.emplace_back(std::move(completion));
+		}
+		if (wake) {
+			const char signal = 1;
+			while (write(wakeWrite, &signal, sizeof(signal)) < 0 && errno == EINTR);
+		}
+	}
+}
@@ -0,0 +1,514 @@
+/****************************************************************************************
+ * benchmark - measures the throughput of the protocol codecs on a single core
+ *
+ ****************************************************************************************/
+
+#include <NetworkMessage.h>
+#include <MessageDispatcher.h>
+#include <Compression.h>
+#include <Database.h>
+#include <TypedDatabase.h>
+#include <Whitelist.h>
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+	
+	struct DecodeCounter {
+		size_t messages = 0;
+		size_t bytes = 0;
+		
+		void onEmpty(int, const std::shared_ptr<void>&, const Generic1Message &) { messages++; }
+		void onMenu(int, const std::shared_ptr<void>&, const MenuMessage &) { messages++; }
+		void onDisplay(int, const std::shared_ptr<void>&, const DisplayMessage & msg) { messages++; bytes += msg.message.length(); }
+		void onUsername(int, const std::shared_ptr<void>&, const LoginSetUsername & msg) { messages++; bytes += msg.username.length(); }
+		void onResponse(int, const std::shared_ptr<void>&, const LoginAuthenticateResponse & msg) { messages++; bytes += msg.success; }
+		void onBatch(int fd, const std::shared_ptr<void>& data, const BatchMessage & msg);
+	};
+	
+	constexpr auto decodeDispatcher = MessageDispatcher<DecodeCounter, void>()
+			.on<Generic1Message,           &DecodeCounter::onEmpty>()
+			.on<MenuMessage,               &DecodeCounter::onMenu>()
+			.on<DisplayMessage,            &DecodeCounter::onDisplay>()
+			.on<LoginSetUsername,          &DecodeCounter::onUsername>()
+			.on<LoginAuthenticateResponse, &DecodeCounter::onResponse>()
+			.on<BatchMessage,              &DecodeCounter::onBatch>();
+	
+	void DecodeCounter::onBatch(int fd, const std::shared_ptr<void>& data, const BatchMessage & msg) {
+		msg.forEach([&](MessageType type, const BufferByte * payload, size_t length) {
+			decodeDispatcher.dispatchFrame(*this, fd, data, type, payload, length);
+		});
+	}
+	
+	std::vector<BufferByte> encodeStream(size_t rounds, bool batched) {
+		const std::string display = "I don't like sand. It's coarse and rough and irritating... and it gets everywhere\n";
+		const std::array<std::shared_ptr<Buffer>, 5> frames = {
+				Generic1Message().encode(),
+				MenuMessage().encode(),
+				DisplayMessage(display).encode(),
+				LoginSetUsername("josh").encode(),
+				LoginAuthenticateResponse(true).encode()
+		};
+		std::vector<BufferByte> stream;
+		BatchBuilder batch{};
+		const auto append = [&stream](const auto & message) {
+			const auto offset = stream.size();
+			stream.resize(offset + message.encodedSize());
+			message.encodeInto(stream.data() + offset, message.encodedSize());
+		};
+		for (size_t i = 0; i < rounds; i++) {
+			for (const auto & frame : frames) {
+				if (!batched) {
+					stream.insert(stream.end(), frame->data(), frame->data() + frame->length());
+				} else if (!batch.add(*frame)) {
+					append(batch);
+					batch.clear();
+					batch.add(*frame);
+				}
+			}
+		}
+		if (!batch.empty())
+			append(batch);
+		return stream;
+	}
+	
+	/// Splits the stream into socket-read sized chunks, as FD::defaultRead would hand them over
+	std::vector<std::shared_ptr<Buffer>> chunkStream(const std::vector<BufferByte> & stream, size_t chunkSize) {
+		std::vector<std::shared_ptr<Buffer>> chunks;
+		for (size_t offset = 0; offset < stream.size(); offset += chunkSize)
+			chunks.emplace_back(std::make_shared<Buffer>(stream.data() + offset, std::min(chunkSize, stream.size() - offset)));
+		return chunks;
+	}
+	
+	void benchmarkDecode(size_t rounds, size_t chunkSize, bool batched) {
+		const auto stream = encodeStream(rounds, batched);
+		const auto chunks = chunkStream(stream, chunkSize);
+		
+		DecodeCounter counter{};
+		DynamicBuffer buffer{};
+		const auto start = std::chrono::steady_clock::now();
+		for (const auto & chunk : chunks) {
+			buffer.addBuffer(chunk);
+			decodeDispatcher.dispatch(counter, -1, nullptr, buffer);
+		}
+		const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		
+		fprintf(stdout, "decode  %s chunk %5zu B  %10zu msgs  %8.3f s  %12.0f msgs/s/core  %8.1f MB/s\n",
+				batched ? "batched" : "framed ", chunkSize, counter.messages, elapsed, counter.messages / elapsed, stream.size() / elapsed / 1e6);
+	}
+	
+	struct TypeCounter {
+		size_t messages = 0;
+		
+		template<typename T>
+		void onMessage(int, const std::shared_ptr<void>&, const T &) { messages++; }
+	};
+	
+	/// Encode, then decode and dispatch, a stream of one message type. Reads are split at each
+	/// size: 1 B splits every header and field, 1460 B is a typical TCP segment. The stream is
+	/// kept small enough that single-byte reads don't exhaust memory.
+	template<typename T>
+	void benchmarkType(const char * name, const T & message, size_t rounds) {
+		static constexpr auto dispatcher = MessageDispatcher<TypeCounter, void>()
+				.on<T, &TypeCounter::template onMessage<T>>();
+		const auto frameLength = message.encodedSize();
+		
+		DynamicBuffer out{};
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rounds; i++) {
+			message.encodeInto(out);
+			if (out.length() >= 64u * 1024u) // As the write buffer drains to the socket
+				out.advanceBuffer(out.length());
+		}
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "type    %-25s encode       %10zu msgs  %8.3f s  %12.0f msgs/s/core  %8.1f MB/s\n",
+				name, rounds, elapsed, rounds / elapsed, rounds * frameLength / elapsed / 1e6);
+		
+		const auto messages = std::max<size_t>(1, std::min(rounds, 256u * 1024u / frameLength));
+		std::vector<BufferByte> stream(messages * frameLength);
+		for (size_t i = 0; i < messages; i++)
+			message.encodeInto(stream.data() + i * frameLength, frameLength);
+		
+		for (size_t chunkSize : {1, 64, 1460, 16384}) {
+			const auto chunks = chunkStream(stream, chunkSize);
+			TypeCounter counter{};
+			DynamicBuffer buffer{};
+			start = std::chrono::steady_clock::now();
+			for (const auto & chunk : chunks) {
+				buffer.addBuffer(chunk);
+				dispatcher.dispatch(counter, -1, nullptr, buffer);
+			}
+			elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			assert(counter.messages == messages);
+			fprintf(stdout, "type    %-25s chunk %5zu B %10zu msgs  %8.3f s  %12.0f msgs/s/core  %8.1f MB/s\n",
+					name, chunkSize, counter.messages, elapsed, counter.messages / elapsed, stream.size() / elapsed / 1e6);
+		}
+	}
+	
+	void benchmarkTypes(size_t rounds) {
+		const std::string display = "I don't like sand. It's coarse and rough and irritating... and it gets everywhere\n";
+		const std::vector<BufferByte> chunk(1024, 'x');
+		benchmarkType("Generic1Message", Generic1Message(), rounds);
+		benchmarkType("HelloMessage", HelloMessage(Capability::PROTOCOL_VERSION, Capability::SUPPORTED), rounds);
+		benchmarkType("DisplayMessage", DisplayMessage(display), rounds);
+		benchmarkType("LoginSetUsername", LoginSetUsername("josh"), rounds);
+		benchmarkType("LoginAuthenticateResponse", LoginAuthenticateResponse(true), rounds);
+		benchmarkType("StreamBegin", StreamBegin(1, MessageType::DISPLAY_MESSAGE), rounds);
+		benchmarkType("StreamChunk", StreamChunk(1, chunk.data(), chunk.size()), rounds);
+		benchmarkType("StreamEnd", StreamEnd(1), rounds);
+	}
+	
+	
+	struct LargePayloadCounter {
+		size_t bytes = 0;
+		
+		void onDisplay(int, const std::shared_ptr<void>&, const DisplayMessage & msg) { bytes += msg.message.length(); }
+		void onBegin(int, const std::shared_ptr<void>&, const StreamBegin &) {}
+		void onChunk(int, const std::shared_ptr<void>&, const StreamChunk & msg) { bytes += msg.chunk.length; }
+		void onEnd(int, const std::shared_ptr<void>&, const StreamEnd &) {}
+	};
+	
+	/// Moves everything queued in `out` to `in` in socket-read sized pieces, dispatching as it goes
+	template<typename Dispatcher>
+	size_t transfer(const Dispatcher & dispatcher, LargePayloadCounter & counter, DynamicBuffer & out, DynamicBuffer & in, size_t peak) {
+		while (out.length() > 0) {
+			in.addBuffer(out.getNext(std::min<size_t>(out.length(), 16384)));
+			peak = std::max(peak, Buffer::allocatedBytes());
+			dispatcher.dispatch(counter, -1, nullptr, in, true);
+		}
+		return peak;
+	}
+	
+	/// Sends one large payload as a single extended frame, then as a stream, reporting the
+	/// buffer memory each needs on top of the payload itself
+	void benchmarkLargePayload(size_t payloadSize) {
+		static constexpr auto dispatcher = MessageDispatcher<LargePayloadCounter, void>()
+				.on<DisplayMessage, &LargePayloadCounter::onDisplay>()
+				.on<StreamBegin,    &LargePayloadCounter::onBegin>()
+				.on<StreamChunk,    &LargePayloadCounter::onChunk>()
+				.on<StreamEnd,      &LargePayloadCounter::onEnd>();
+		const std::string payload(payloadSize, 'x');
+		const auto baseline = Buffer::allocatedBytes();
+		
+		LargePayloadCounter counter{};
+		DynamicBuffer out{}, in{};
+		auto start = std::chrono::steady_clock::now();
+		DisplayMessage(payload).encodeInto(out);
+		auto peak = transfer(dispatcher, counter, out, in, Buffer::allocatedBytes());
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "large   extended frame %9zu B  %8.3f s  %8.1f MB/s  peak buffers %9zu B\n",
+				counter.bytes, elapsed, counter.bytes / elapsed / 1e6, peak - baseline);
+		
+		counter = LargePayloadCounter{};
+		size_t offset = 0;
+		StreamProducer producer(1, MessageType::DISPLAY_MESSAGE, [&](BufferByte * dst, size_t capacity) {
+			const auto length = std::min(capacity, payload.length() - offset);
+			memcpy(dst, payload.data() + offset, length);
+			offset += length;
+			return length;
+		});
+		peak = baseline;
+		start = std::chrono::steady_clock::now();
+		for (bool producing = true; producing; ) {
+			while (producing && out.length() < 64u * 1024u) // As FD::produce tops up the write buffer
+				producing = producer(out);
+			peak = transfer(dispatcher, counter, out, in, peak);
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "large   stream         %9zu B  %8.3f s  %8.1f MB/s  peak buffers %9zu B\n",
+				counter.bytes, elapsed, counter.bytes / elapsed / 1e6, peak - baseline);
+	}
+	
+	/// Encodes a DisplayMessage + LoginAuthenticateResponse pair, as a login reply would
+	void benchmarkEncode(size_t rounds) {
+		const std::string display = "Invalid password.  2 attempts remaining.\n";
+		size_t bytes = 0;
+		
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rounds; i++) {
+			DynamicBuffer buffer{};
+			buffer.addBuffer(DisplayMessage(display).encode());
+			buffer.addBuffer(LoginAuthenticateResponse(false).encode());
+			bytes += buffer.length();
+		}
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "encode  standalone buffers   %10zu msgs  %8.3f s  %12.0f msgs/s/core  %8.1f MB/s\n",
+				rounds * 2, elapsed, rounds * 2 / elapsed, bytes / elapsed / 1e6);
+		
+		bytes = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rounds; i++) {
+			DynamicBuffer buffer{};
+			DisplayMessage(display).encodeInto(buffer);
+			LoginAuthenticateResponse(false).encodeInto(buffer);
+			bytes += buffer.length();
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "encode  into write buffer    %10zu msgs  %8.3f s  %12.0f msgs/s/core  %8.1f MB/s\n",
+				rounds * 2, elapsed, rounds * 2 / elapsed, bytes / elapsed / 1e6);
+		
+		const auto cached = DisplayMessage(display).encode();
+		bytes = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < rounds; i++) {
+			DynamicBuffer buffer{};
+			buffer.addBuffer(static_cast<const Buffer &>(*cached));
+			LoginAuthenticateResponse(false).encodeInto(buffer);
+			bytes += buffer.length();
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "encode  cached + write buffer%10zu msgs  %8.3f s  %12.0f msgs/s/core  %8.1f MB/s\n",
+				rounds * 2, elapsed, rounds * 2 / elapsed, bytes / elapsed / 1e6);
+	}
+	
+	/// Bytes on the wire against the CPU spent compressing and decompressing, per message
+	void benchmarkCompression(size_t rounds) {
+		std::string menu = "Available Commands:\n"
+				"    hello      Custom server greeting\n"
+				"    1,2,3,4,5  Each number provides a different message\n"
+				"    passwd     In a future version, this will allow you to change your password\n"
+				"    menu       Displays this menu\n"
+				"    exit       Disconnects you from the server\n";
+		std::string bulk{};
+		for (size_t i = 0; bulk.length() < 64u * 1024u; i++)
+			bulk += std::to_string(i) + "\tjosh\t127.0.0.1\tlogged in\n";
+		
+		for (const auto & [name, text] : {std::make_pair("menu", std::string_view(menu)), std::make_pair("64 KiB log", std::string_view(bulk))}) {
+			fprintf(stdout, "compress %-10s  none %6zu B\n", name, FrameHeader::frameLength(text.length()));
+			for (size_t codec = 0; codec < static_cast<size_t>(Compression::Codec::COUNT); codec++) {
+				const auto iterations = std::max<size_t>(1, rounds / (text.length() / 256 + 1));
+				std::optional<std::vector<BufferByte>> compressed;
+				auto start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < iterations; i++)
+					compressed = Compression::compress(static_cast<Compression::Codec>(codec), text);
+				const auto compressTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+				if (!compressed.has_value()) {
+					fprintf(stdout, "compress %-10s  %-4s unavailable or no gain\n", name, codec == 0 ? "lz" : "zlib");
+					continue;
+				}
+				
+				std::string decompressed{};
+				start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < iterations; i++)
+					Compression::decompress(compressed->data(), compressed->size(), decompressed);
+				const auto decompressTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / iterations;
+				assert(decompressed == text);
+				fprintf(stdout, "compress %-10s  %-4s %6zu B  %8.2f us compress  %8.2f us decompress\n",
+						name, codec == 0 ? "lz" : "zlib", FrameHeader::frameLength(compressed->size()), compressTime * 1e6, decompressTime * 1e6);
+			}
+		}
+	}
+	
+	/// Rewrites a passwd-like file of `rows` rows, writing each column and separator with its
+	/// own syscall as Database used to, then through Database::update and its RowWriter
+	void benchmarkRewrite(size_t rows) {
+		const std::string filename = "benchmark.db";
+		Database<3, ','> db(filename);
+		{
+			const auto fd = open(filename.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+			RowWriter writer(fd, ',');
+			for (size_t i = 0; i < rows; i++)
+				writer.writeRow(std::array<std::string, 3>{"user" + std::to_string(i), "c2FsdHNhbHRzYWx0c2FsdA==", "aGFzaGhhc2hoYXNoaGFzaGhhc2hoYXNoaGFzaGhhc2g="});
+			writer.flush();
+			close(fd);
+		}
+		
+		auto start = std::chrono::steady_clock::now();
+		const auto tmpfile = filename + ".tmp";
+		const auto fd = open(tmpfile.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+		db.scan([fd](const auto & row) {
+			for (size_t i = 0; i < row.size(); i++) {
+				if (i > 0)
+					write(fd, ",", 1);
+				write(fd, row[i].data(), row[i].length());
+			}
+			write(fd, "\n", 1);
+			return true;
+		});
+		close(fd);
+		rename(tmpfile.c_str(), filename.c_str());
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "rewrite %8zu rows  unbuffered  %8.3f s\n", rows, elapsed);
+		
+		start = std::chrono::steady_clock::now();
+		db.update([](const auto & row) { return row; });
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "rewrite %8zu rows  RowWriter   %8.3f s\n", rows, elapsed);
+		remove(filename.c_str());
+	}
+	
+	/// Looks for the last user of a passwd-like file of `rows` rows with Database::find, which
+	/// copies every row into strings, the scan() callback, and the scan() range, which only splits
+	/// out the username column
+	void benchmarkScan(size_t rows) {
+		const std::string filename = "benchmark.db";
+		Database<3, ','> db(filename);
+		{
+			const auto fd = open(filename.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+			RowWriter writer(fd, ',');
+			for (size_t i = 0; i < rows; i++)
+				writer.writeRow(std::array<std::string, 3>{"user" + std::to_string(i), "c2FsdHNhbHRzYWx0c2FsdA==", "aGFzaGhhc2hoYXNoaGFzaGhhc2hoYXNoaGFzaGhhc2g="});
+			writer.flush();
+			close(fd);
+		}
+		const auto name = "user" + std::to_string(rows - 1);
+		const size_t lookups = 20;
+		
+		size_t found = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < lookups; i++)
+			found += db.find([&](const auto & row) { return row[0] == name; }).has_value();
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "scan %8zu rows  find      %8.3f ms/lookup  (%zu found)\n", rows, elapsed * 1e3 / lookups, found);
+		
+		found = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < lookups; i++) {
+			db.scan([&](const auto & row) {
+				if (row[0] != name)
+					return true;
+				found++;
+				return false;
+			});
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "scan %8zu rows  callback  %8.3f ms/lookup  (%zu found)\n", rows, elapsed * 1e3 / lookups, found);
+		
+		found = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < lookups; i++) {
+			for (const auto & row : db.scan()) {
+				if (row[0] == name) {
+					found++;
+					break;
+				}
+			}
+		}
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "scan %8zu rows  range     %8.3f ms/lookup  (%zu found)\n", rows, elapsed * 1e3 / lookups, found);
+		remove(filename.c_str());
+	}
+	
+	struct Account {
+		std::string username;
+		std::string salt;
+		std::string hash;
+	};
+	
+	using AccountSchema = TableSchema<Column<&Account::username>, Column<&Account::salt>, Column<&Account::hash>>;
+	
+	/// Looks up users in a passwd-like file of `rows` rows with a full-scan Database::find, then
+	/// through a TypedDatabase index on the username
+	void benchmarkIndexedFind(size_t rows) {
+		const std::string filename = "benchmark.db";
+		TypedDatabase<AccountSchema, ',', Index<&Account::username>> accounts(filename);
+		for (size_t i = 0; i < rows; i++)
+			accounts.insert({"user" + std::to_string(i), "c2FsdHNhbHRzYWx0c2FsdA==", "aGFzaGhhc2hoYXNoaGFzaGhhc2hoYXNoaGFzaGhhc2g="});
+		
+		Database<3, ','> db(filename);
+		const size_t scans = 100;
+		size_t found = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < scans; i++) {
+			const auto username = "user" + std::to_string(i * 7919 % rows);
+			found += db.find([&](const auto & row) { return row[0] == username; }).has_value();
+		}
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "find    %8zu rows  scan        %8.3f us/lookup\n", rows, elapsed * 1e6 / scans);
+		
+		const size_t lookups = 1000000;
+		accounts.find(where<&Account::username>("user0")); // Load the file outside the timing
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < lookups; i++)
+			found += accounts.find(where<&Account::username>("user" + std::to_string(i * 7919 % rows))).has_value();
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "find    %8zu rows  index       %8.3f us/lookup\n", rows, elapsed * 1e6 / lookups);
+		if (found != scans + lookups)
+			fprintf(stderr, "Lookups missed %zu rows\n", scans + lookups - found);
+		remove(filename.c_str());
+	}
+	
+	/// Checks client addresses against a whitelist of `ranges` addresses: formatted and looked up
+	/// in a CachedDatabase, then matched on the raw address by a Whitelist
+	void benchmarkWhitelist(size_t ranges) {
+		const std::string filename = "benchmark.db";
+		std::vector<uint32_t> addresses(ranges);
+		{
+			const auto fd = open(filename.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+			RowWriter writer(fd, ',');
+			for (size_t i = 0; i < ranges; i++) {
+				addresses[i] = static_cast<uint32_t>(0x0A000000u + i * 2654435761u % 0x00FFFFFFu);
+				std::array<char, INET_ADDRSTRLEN> text{};
+				const auto network = htonl(addresses[i]);
+				inet_ntop(AF_INET, &network, text.data(), text.size());
+				writer.writeRow(std::array<std::string, 1>{text.data()});
+			}
+			writer.flush();
+			close(fd);
+		}
+		std::vector<sockaddr_in> clients(1024);
+		for (size_t i = 0; i < clients.size(); i++) {
+			clients[i].sin_family = AF_INET;
+			clients[i].sin_addr.s_addr = htonl(addresses[i % ranges] + (i & 1u)); // Half of them allowed
+		}
+		
+		const size_t checks = 1000000;
+		CachedDatabase<1, ','> cached(filename);
+		size_t allowed = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < checks; i++) {
+			std::array<char, INET_ADDRSTRLEN> text{};
+			inet_ntop(AF_INET, &clients[i % clients.size()].sin_addr, text.data(), text.size());
+			allowed += cached.get(text.data()).has_value();
+		}
+		auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "whitelist %6zu entries  string lookup  %8.1f ns/check  (%zu allowed)\n", ranges, elapsed * 1e9 / checks, allowed);
+		
+		Whitelist whitelist(filename);
+		allowed = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < checks; i++)
+			allowed += whitelist.allows(reinterpret_cast<const sockaddr *>(&clients[i % clients.size()]));
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "whitelist %6zu entries  trie           %8.1f ns/check  (%zu allowed)\n", ranges, elapsed * 1e9 / checks, allowed);
+		
+		whitelist.setWatched(true); // As when a FileWatcher refreshes it, so checks skip the stat()
+		allowed = 0;
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < checks; i++)
+			allowed += whitelist.allows(reinterpret_cast<const sockaddr *>(&clients[i % clients.size()]));
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		fprintf(stdout, "whitelist %6zu entries  trie, watched  %8.1f ns/check  (%zu allowed)\n", ranges, elapsed * 1e9 / checks, allowed);
+		remove(filename.c_str());
+	}
+}
+
+int main(int argc, char *argv[]) {
+	size_t rounds = 1000000;
+	if (argc > 1)
+		rounds = strtoul(argv[1], nullptr, 10);
+	
+	for (bool batched : {false, true}) {
+		for (size_t chunkSize : {64, 1024, 16384})
+			benchmarkDecode(rounds, chunkSize, batched);
+	}
+	benchmarkTypes(rounds);
+	benchmarkEncode(rounds);
+	benchmarkLargePayload(16u * 1024u * 1024u);
+	benchmarkCompression(rounds);
+	for (size_t rows : {10000, 100000, 1000000})
+		benchmarkRewrite(rows);
+	for (size_t rows : {100000, 1000000})
+		benchmarkScan(rows);
+	for (size_t rows : {10000, 100000})
+		benchmarkIndexedFind(rows);
+	for (size_t ranges : {100, 10000})
+		benchmarkWhitelist(ranges);
+	return 0;
+}
@@ -0,0 +1,114 @@
+/****************************************************************************************
+ * bulkadduser - creates many user accounts at once from "username,password" lines
+ *
+ ****************************************************************************************/
+
+#include <Database.h>
+#include <Security.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <unordered_set>
+
+namespace {
+	constexpr size_t HASH_MEMORY = 64u * 1024u * 1024u;    // What each Argon2 hash holds while it runs
+	constexpr size_t BATCH_MEMORY_LIMIT = 1024u * 1024u * 1024u;
+	
+	struct NewUser {
+		std::string name;
+		std::string password;
+	};
+	
+	bool validUsername(const std::string & username) {
+		if (username.find(',') != std::string::npos) {
+			fprintf(stderr, "Usernames cannot have a comma in them.\n");
+			return false;
+		}
+		if (username.find('\t') != std::string::npos) {
+			fprintf(stderr, "Usernames cannot have a tab in them.\n");
+			return false;
+		}
+		return true;
+	}
+	
+	/**
+	 * Adds every "username,password" line of `input` that names a new user. Existing users are
+	 * read through a CachedDatabase, so accounts the server has only logged to passwd.wal so far
+	 * count too. The passwords are hashed on as many threads as there are cores, up to
+	 * BATCH_MEMORY_LIMIT worth of hashes at a time, and passwd is rewritten once with all of
+	 * the new users.
+	 */
+	int addUsers(std::istream & input) {
+		CachedDatabase<3, ','> passwd("passwd");
+		std::unordered_set<std::string> names{};
+		passwd.find([&](const auto & row) { names.emplace(row[0]); return false; });
+		
+		std::vector<NewUser> users{};
+		size_t skipped = 0;
+		std::string line;
+		for (size_t number = 1; std::getline(input, line); number++) {
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			if (line.empty())
+				continue;
+			const auto comma = line.find(',');
+			NewUser user{line.substr(0, comma), comma == std::string::npos ? std::string() : line.substr(comma + 1)};
+			if (comma == std::string::npos || user.name.empty() || user.password.empty()) {
+				fprintf(stderr, "Line %zu: expected username,password\n", number);
+				skipped++;
+			} else if (!validUsername(user.name)) {
+				skipped++;
+			} else if (!names.insert(user.name).second) {
+				fprintf(stderr, "Line %zu: %s already has an account.\n", number, user.name.c_str());
+				skipped++;
+			} else {
+				users.push_back(std::move(user));
+			}
+		}
+		
+		const size_t threadCount = std::max<size_t>(1, std::min<size_t>({std::thread::hardware_concurrency(),
+				BATCH_MEMORY_LIMIT / HASH_MEMORY, users.size()}));
+		std::vector<Database<3, ','>::DatabaseRow> rows(users.size());
+		std::atomic<size_t> next{0};
+		std::vector<std::thread> threads{};
+		for (size_t i = 0; i < threadCount; i++) {
+			threads.emplace_back([&]() {
+				for (size_t user = next++; user < users.size(); user = next++) {
+					auto salt = Security::INSTANCE()->generateSalt();
+					auto hash = Security::INSTANCE()->hash(users[user].password, salt);
+					rows[user] = {users[user].name, std::move(salt), std::move(hash)};
+				}
+			});
+		}
+		for (auto & thread : threads)
+			thread.join();
+		
+		if (!rows.empty() && !passwd.insert(rows)) {
+			fprintf(stderr, "Failed to add users. Unknown error.\n");
+			return -1;
+		}
+		fprintf(stdout, "Added %zu users, skipped %zu.\n", rows.size(), skipped);
+		return skipped == 0 ? 0 : 1;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
+		fprintf(stdout, "%s [file]   Adds a username,password per line of file, or stdin\n", argv[0]);
+		return 0;
+	}
+	
+	if (argc < 2 || strcmp(argv[1], "-") == 0)
+		return addUsers(std::cin);
+	std::ifstream input(argv[1]);
+	if (!input) {
+		fprintf(stderr, "Failed to open %s: %s\n", argv[1], strerror(errno));
+		return -1;
+	}
+	return addUsers(input);
+}
@@ -0,0 +1,600 @@
+/****************************************************************************************
+ * check - exercises the password, database and whitelist stores, including the cases
+ *         that need several processes or a crash partway through to show up
+ *
+ ****************************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <PasswdMgr.h>
+#include <AsyncLogger.h>
+#include <Database.h>
+#include <TypedDatabase.h>
+#include <Whitelist.h>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+namespace {
+	int failures = 0;
+	
+	void check(bool passed, const char * condition, const char * file, int line) {
+		if (!passed) {
+			fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+			failures++;
+		}
+	}
+	
+	template<typename Op>
+	bool throws(Op op) {
+		try {
+			op();
+		} catch (const std::exception &) {
+			return true;
+		}
+		return false;
+	}
+	
+	void removeFiles(const std::string & filename) {
+		for (const char * suffix : {"", ".wal", ".wal.old"})
+			remove((filename + suffix).c_str());
+	}
+	
+	void checkPasswdMgr() {
+		const std::string filename = "check.passwd";
+		removeFiles(filename);
+		PasswdMgr passwd(filename.c_str());
+		
+		CHECK(!passwd.checkUser("josh"));
+		CHECK(!passwd.changePasswd("josh", "secret"));
+		CHECK(throws([&] { passwd.addUser("", "secret"); }));
+		CHECK(throws([&] { passwd.addUser(std::string(PasswdMgr::namelen, 'a').c_str(), "secret"); }));
+		
+		// Added out of order, so each insert lands somewhere else in the sorted file
+		for (const char * name : {"mike", "Josh", "zed", "anna", "kim"})
+			passwd.addUser(name, name);
+		for (const char * name : {"mike", "josh", "JOSH", "zed", "anna", "kim"})
+			CHECK(passwd.checkUser(name));
+		CHECK(!passwd.checkUser("bob"));
+		CHECK(passwd.checkPasswd("josh", "Josh"));
+		CHECK(!passwd.checkPasswd("josh", "josh"));
+		CHECK(throws([&] { passwd.addUser("JOSH", "again"); }));
+		
+		CHECK(passwd.changePasswd("Kim", "changed"));
+		CHECK(passwd.checkPasswd("kim", "changed"));
+		CHECK(!passwd.checkPasswd("kim", "kim"));
+		
+		// Another manager on the same file, as another process would be: a user added there
+		// replaces the file and shifts the records after it, which this one has mapped
+		PasswdMgr other(filename.c_str());
+		CHECK(passwd.checkUser("mike"));
+		other.addUser("jack", "jack");
+		CHECK(passwd.changePasswd("mike", "changed"));
+		CHECK(other.checkPasswd("mike", "changed"));
+		CHECK(other.checkPasswd("kim", "changed"));
+		CHECK(passwd.checkPasswd("jack", "jack"));
+		CHECK(passwd.checkPasswd("anna", "anna"));
+		
+		// Processes adding users and changing passwords at the same time lose nothing
+		constexpr int writers = 4, rounds = 5;
+		std::vector<pid_t> children{};
+		for (int writer = 0; writer < writers; writer++) {
+			const pid_t child = fork();
+			if (child == 0) {
+				PasswdMgr mine(filename.c_str());
+				for (int round = 0; round < rounds; round++) {
+					const auto name = "user" + std::to_string(writer) + "x" + std::to_string(round);
+					mine.addUser(name.c_str(), name.c_str());
+					mine.changePasswd(name.c_str(), (name + "!").c_str());
+				}
+				_exit(0);
+			}
+			children.push_back(child);
+		}
+		for (const auto child : children) {
+			int status = 0;
+			CHECK(waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		}
+		for (int writer = 0; writer < writers; writer++) {
+			for (int round = 0; round < rounds; round++) {
+				const auto name = "user" + std::to_string(writer) + "x" + std::to_string(round);
+				CHECK(passwd.checkPasswd(name.c_str(), (name + "!").c_str()));
+			}
+		}
+		CHECK(passwd.checkPasswd("zed", "zed"));
+		removeFiles(filename);
+	}
+	
+	using Table = Database<3, ','>;
+	using Passwd = CachedDatabase<3, ','>;
+	
+	/// Whether `db` has `key` with `value` in its last column
+	bool has(Passwd & db, const std::string & key, const std::string & value) {
+		const auto row = db.get(key);
+		return row && (*row)[2] == value;
+	}
+	
+	/// Lets a CachedDatabase notice a change it didn't make itself
+	void waitForStat() {
+		std::this_thread::sleep_for(Passwd::STAT_INTERVAL * 2);
+	}
+	
+	void checkCachedDatabase() {
+		const std::string filename = "check.db";
+		removeFiles(filename);
+		Passwd cached(filename);
+		Table direct(filename);
+		
+		CHECK(!cached.get("josh"));
+		CHECK(cached.insert({"josh", "salt", "1"}));
+		CHECK(has(cached, "josh", "1"));
+		
+		// Written around the cache, as another process would
+		CHECK(direct.insert({"anna", "salt", "1"}));
+		waitForStat();
+		CHECK(has(cached, "anna", "1"));
+		CHECK(direct.update([](const auto & row) { return Table::DatabaseRow{row[0], row[1], "2"}; }));
+		waitForStat();
+		CHECK(has(cached, "josh", "2"));
+		CHECK(has(cached, "anna", "2"));
+		
+		// reload() doesn't wait for the stat
+		CHECK(direct.insert({"kim", "salt", "1"}));
+		cached.reload();
+		CHECK(has(cached, "kim", "1"));
+		
+		CHECK(cached.update([](const auto & row) { return Table::DatabaseRow{row[0], row[1], row[0]}; }));
+		CHECK(has(cached, "josh", "josh"));
+		CHECK(direct.find([](const auto & row) { return row[0] == "kim" && row[2] == "kim"; }).has_value());
+		const auto found = cached.find([](const auto & row) { return row[2] == "anna"; });
+		CHECK(found && (*found)[0] == "anna");
+		removeFiles(filename);
+	}
+	
+	bool exists(const std::string & filename) {
+		struct stat info{};
+		return stat(filename.c_str(), &info) == 0;
+	}
+	
+	void checkWriteAheadLog() {
+		const std::string filename = "check.db";
+		removeFiles(filename);
+		{
+			Passwd db(filename);
+			CHECK(db.insert({"josh", "salt", "1"}));
+			CHECK(db.replace({"josh", "salt", "2"}));
+			CHECK(db.replace({"anna", "salt", "1"}));
+			CHECK(has(db, "josh", "2"));
+		}
+		// Only logged so far, and replayed by the next instance
+		CHECK(exists(filename + ".wal"));
+		CHECK(Table(filename).find([](const auto & row) { return row[0] == "josh"; }).value()[2] == "1");
+		{
+			Passwd db(filename);
+			CHECK(has(db, "josh", "2"));
+			CHECK(has(db, "anna", "1"));
+		}
+		
+		// A crash during compaction leaves the old log behind, possibly with the file already
+		// rewritten from it; either way it is replayed under the newer log
+		CHECK(Table(filename + ".wal.old").insert({"kim", "salt", "1"}));
+		CHECK(Table(filename + ".wal.old").insert({"anna", "salt", "0"}));
+		{
+			Passwd db(filename);
+			CHECK(has(db, "kim", "1"));
+			CHECK(has(db, "anna", "1"));
+			CHECK(has(db, "josh", "2"));
+		}
+		
+		// Enough changes to compact, which folds both logs into the file
+		{
+			Passwd db(filename);
+			for (size_t i = 0; i < Passwd::COMPACT_AFTER; i++)
+				CHECK(db.replace({"user" + std::to_string(i), "salt", "1"}));
+		}
+		CHECK(!exists(filename + ".wal.old"));
+		{
+			Table direct(filename);
+			CHECK(direct.find([](const auto & row) { return row[0] == "kim" && row[2] == "1"; }).has_value());
+			CHECK(direct.find([](const auto & row) { return row[0] == "josh" && row[2] == "2"; }).has_value());
+			Passwd db(filename);
+			CHECK(has(db, "user0", "1"));
+			CHECK(has(db, "user" + std::to_string(Passwd::COMPACT_AFTER - 1), "1"));
+		}
+		removeFiles(filename);
+		
+		// Threads replacing rows while compactions run lose none of them
+		{
+			Passwd db(filename);
+			constexpr size_t writers = 4, rows = Passwd::COMPACT_AFTER;
+			std::vector<std::thread> threads{};
+			for (size_t writer = 0; writer < writers; writer++) {
+				threads.emplace_back([&, writer]() {
+					for (size_t i = 0; i < rows; i++)
+						db.replace({std::to_string(writer) + "x" + std::to_string(i), "salt", std::to_string(i)});
+				});
+			}
+			for (auto & thread : threads)
+				thread.join();
+			size_t missing = 0;
+			for (size_t writer = 0; writer < writers; writer++) {
+				for (size_t i = 0; i < rows; i++)
+					missing += !has(db, std::to_string(writer) + "x" + std::to_string(i), std::to_string(i));
+			}
+			CHECK(missing == 0);
+		}
+		removeFiles(filename);
+		
+		// Another process appending to the file while it is compacted loses nothing either. The
+		// appends are timed to land while the old log exists, which is when a compaction runs.
+		{
+			Table seed(filename);
+			for (size_t i = 0; i < 10000; i++)
+				seed.insert({"seed" + std::to_string(i), "salt", "1"});
+		}
+		constexpr size_t appended = 300;
+		const pid_t child = fork();
+		if (child == 0) {
+			Table db(filename);
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+			for (size_t i = 0; i < appended; ) {
+				while (!exists(filename + ".wal.old") && std::chrono::steady_clock::now() < deadline)
+					usleep(50);
+				for (size_t burst = 0; burst < 30 && i < appended; burst++, i++) {
+					if (!db.insert({"ext" + std::to_string(i), "salt", "1"}))
+						_exit(1);
+				}
+				usleep(1000);
+			}
+			_exit(0);
+		}
+		size_t replaced = 0;
+		{
+			Passwd db(filename);
+			int status = 0;
+			while (waitpid(child, &status, WNOHANG) == 0 || replaced < Passwd::COMPACT_AFTER * 2)
+				db.replace({"key" + std::to_string(replaced++), "salt", "1"});
+			CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		}
+		{
+			Passwd db(filename);
+			size_t missing = 0;
+			for (size_t i = 0; i < appended; i++)
+				missing += !has(db, "ext" + std::to_string(i), "1");
+			for (size_t i = 0; i < replaced; i++)
+				missing += !has(db, "key" + std::to_string(i), "1");
+			CHECK(missing == 0);
+		}
+		removeFiles(filename);
+	}
+	
+	/// `text` as an IPv4 or IPv6 socket address
+	sockaddr_storage address(const char * text) {
+		sockaddr_storage storage{};
+		auto ipv4 = reinterpret_cast<sockaddr_in *>(&storage);
+		auto ipv6 = reinterpret_cast<sockaddr_in6 *>(&storage);
+		if (inet_pton(AF_INET, text, &ipv4->sin_addr) == 1)
+			ipv4->sin_family = AF_INET;
+		else if (inet_pton(AF_INET6, text, &ipv6->sin6_addr) == 1)
+			ipv6->sin6_family = AF_INET6;
+		return storage;
+	}
+	
+	bool allows(Whitelist & whitelist, const char * text) {
+		const auto storage = address(text);
+		return whitelist.allows(reinterpret_cast<const sockaddr *>(&storage));
+	}
+	
+	void writeWhitelist(const std::string & filename, const std::vector<std::string> & entries) {
+		removeFiles(filename);
+		Database<1, ','> file(filename);
+		for (const auto & entry : entries)
+			file.insert({entry});
+	}
+	
+	void checkWhitelist() {
+		const std::string filename = "check.whitelist";
+		writeWhitelist(filename, {"10.0.0.0/8", "192.168.1.5", "172.16.0.0/12", "::ffff:100.64.0.0/106",
+				"2001:db8::/32", "::1", " 203.0.113.0/24 ", "300.1.1.1", "10.0.0.0/33", "2001:db8::/129", "nonsense"});
+		Whitelist whitelist(filename);
+		
+		CHECK(allows(whitelist, "10.0.0.0"));
+		CHECK(allows(whitelist, "10.255.255.255"));
+		CHECK(!allows(whitelist, "11.0.0.0"));
+		CHECK(!allows(whitelist, "9.255.255.255"));
+		CHECK(allows(whitelist, "192.168.1.5"));
+		CHECK(!allows(whitelist, "192.168.1.4"));
+		CHECK(!allows(whitelist, "192.168.1.6"));
+		// A prefix that doesn't end on a byte boundary
+		CHECK(allows(whitelist, "172.16.0.0"));
+		CHECK(allows(whitelist, "172.31.255.255"));
+		CHECK(!allows(whitelist, "172.32.0.0"));
+		CHECK(!allows(whitelist, "172.15.255.255"));
+		CHECK(allows(whitelist, "203.0.113.77"));
+		// An IPv4-mapped entry is an IPv4 range, here 100.64.0.0/10
+		CHECK(allows(whitelist, "100.127.255.255"));
+		CHECK(!allows(whitelist, "100.128.0.0"));
+		
+		CHECK(allows(whitelist, "2001:db8::"));
+		CHECK(allows(whitelist, "2001:db8:ffff:ffff:ffff:ffff:ffff:ffff"));
+		CHECK(!allows(whitelist, "2001:db9::"));
+		CHECK(allows(whitelist, "::1"));
+		CHECK(!allows(whitelist, "::2"));
+		CHECK(!allows(whitelist, "::"));
+		
+		// IPv4-mapped clients match the IPv4 entries, and only those
+		CHECK(allows(whitelist, "::ffff:10.1.2.3"));
+		CHECK(allows(whitelist, "::ffff:100.64.0.1"));
+		CHECK(!allows(whitelist, "::ffff:11.1.2.3"));
+		CHECK(!allows(whitelist, "::ffff:0:1"));
+		
+		sockaddr_storage local{};
+		local.ss_family = AF_UNIX;
+		CHECK(!whitelist.allows(reinterpret_cast<const sockaddr *>(&local)));
+		
+		// /0 covers a whole family, and a longer prefix added under a shorter one changes nothing
+		writeWhitelist(filename, {"10.1.0.0/16", "0.0.0.0/0", "10.2.3.4"});
+		whitelist.reload();
+		CHECK(allows(whitelist, "1.2.3.4"));
+		CHECK(allows(whitelist, "255.255.255.255"));
+		CHECK(allows(whitelist, "::ffff:1.2.3.4"));
+		CHECK(!allows(whitelist, "::2"));
+		writeWhitelist(filename, {"::/0"});
+		whitelist.reload();
+		CHECK(allows(whitelist, "2001:db8::1"));
+		CHECK(!allows(whitelist, "1.2.3.4"));
+		
+		// A missing whitelist allows nobody
+		writeWhitelist(filename, {});
+		whitelist.reload();
+		CHECK(!allows(whitelist, "10.0.0.1"));
+		CHECK(!allows(whitelist, "::1"));
+		
+		// A change is noticed without reload() once the stat is due again
+		writeWhitelist(filename, {"10.0.0.1"});
+		std::this_thread::sleep_for(StatThrottle::INTERVAL * 2);
+		CHECK(allows(whitelist, "10.0.0.1"));
+		
+		// Whitelists checked from the same thread keep apart
+		const std::string otherFilename = "check.whitelist2";
+		writeWhitelist(otherFilename, {"192.0.2.0/24"});
+		{
+			Whitelist other(otherFilename);
+			CHECK(allows(other, "192.0.2.1"));
+			CHECK(!allows(whitelist, "192.0.2.1"));
+			CHECK(!allows(other, "10.0.0.1"));
+		}
+		Whitelist replacement(otherFilename);
+		CHECK(!allows(replacement, "10.0.0.1"));
+		CHECK(allows(replacement, "192.0.2.1"));
+		CHECK(allows(whitelist, "10.0.0.1"));
+		removeFiles(otherFilename);
+		removeFiles(filename);
+	}
+	
+	struct Account {
+		std::string name;
+		int uid = 0;
+		bool admin = false;
+	};
+	
+	using Accounts = TypedDatabase<TableSchema<Column<&Account::name>, Column<&Account::uid>, Column<&Account::admin>>, ',',
+			Index<&Account::name>, Index<&Account::uid>>;
+	
+	void checkTypedDatabase() {
+		const std::string filename = "check.accounts";
+		removeFiles(filename);
+		Accounts accounts(filename);
+		
+		CHECK(!accounts.find(where<&Account::name>("josh")));
+		CHECK(accounts.insert({"josh", 1000, true}));
+		CHECK(accounts.insert({"anna", 1001, false}));
+		auto found = accounts.find(where<&Account::name>("josh"));
+		CHECK(found && found->uid == 1000 && found->admin);
+		found = accounts.find(where<&Account::uid>(1001));
+		CHECK(found && found->name == "anna");
+		
+		// An insert after a lookup is indexed on the next one
+		CHECK(accounts.insert({"kim", 1002, false}));
+		found = accounts.find(where<&Account::uid>(1002));
+		CHECK(found && found->name == "kim");
+		
+		// So is an update that changes indexed columns, and the old values no longer match
+		CHECK(accounts.update([](const Account & account) {
+			return account.name == "kim" ? Account{"kimberly", 2002, true} : account;
+		}));
+		CHECK(!accounts.find(where<&Account::name>("kim")));
+		CHECK(!accounts.find(where<&Account::uid>(1002)));
+		found = accounts.find(where<&Account::uid>(2002));
+		CHECK(found && found->name == "kimberly" && found->admin);
+		
+		// As is a change made around it, once the file looks different and the stat is due
+		CHECK(Table(filename).update([](const auto & row) {
+			return row[0] == "anna" ? Table::DatabaseRow{"anna", "3001", "1"} : row;
+		}));
+		waitForStat();
+		found = accounts.find(where<&Account::name>("anna"));
+		CHECK(found && found->uid == 3001 && found->admin);
+		CHECK(!accounts.find(where<&Account::uid>(1001)));
+		
+		// Rows that don't parse are left out of the indexes but kept in the file
+		CHECK(Table(filename).insert({"broken", "not a number", "1"}));
+		accounts.reload();
+		CHECK(!accounts.find(where<&Account::name>("broken")));
+		CHECK(accounts.update([](const Account & account) { return account; }));
+		CHECK(Table(filename).find([](const auto & row) { return row[0] == "broken"; }).has_value());
+		
+		// The first of several rows with the same key is the one found
+		CHECK(accounts.insert({"josh", 4000, false}));
+		found = accounts.find(where<&Account::name>("josh"));
+		CHECK(found && found->uid == 1000);
+		found = accounts.find([](const Account & account) { return account.uid == 4000; });
+		CHECK(found && found->name == "josh");
+		
+		// An insert on top of an append made around it still picks that append up
+		CHECK(Table(filename).insert({"ext", "4500", "0"}));
+		CHECK(accounts.insert({"mine", 4600, false}));
+		found = accounts.find(where<&Account::uid>(4500));
+		CHECK(found && found->name == "ext");
+		found = accounts.find(where<&Account::name>("mine"));
+		CHECK(found && found->uid == 4600);
+		
+		// A watched one trusts what it has until reload(), however long it has been
+		accounts.setWatched(true);
+		CHECK(Table(filename).insert({"lee", "5000", "0"}));
+		waitForStat();
+		CHECK(!accounts.find(where<&Account::name>("lee")));
+		accounts.reload();
+		found = accounts.find(where<&Account::name>("lee"));
+		CHECK(found && found->uid == 5000);
+		removeFiles(filename);
+	}
+	
+	/// The closed segments of the log `filename`, which is in the current directory
+	std::vector<std::string> logSegments(const std::string & filename) {
+		std::vector<std::string> segments{};
+		DIR * directory = opendir(".");
+		if (directory == nullptr)
+			return segments;
+		const auto prefix = filename + ".";
+		while (const auto entry = readdir(directory)) {
+			if (std::string(entry->d_name).compare(0, prefix.length(), prefix) == 0)
+				segments.emplace_back(entry->d_name);
+		}
+		closedir(directory);
+		return segments;
+	}
+	
+	void checkLogRotation() {
+		const std::string filename = "check.log";
+		for (const auto & segment : logSegments(filename))
+			remove(segment.c_str());
+		remove(filename.c_str());
+		{
+			AsyncLogger logger(filename, {256, 0, 0});
+			CHECK(logger.log("first segment"));
+			// Let the writer empty the ring, so the next record goes in a batch of its own
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			CHECK(logger.log(std::string(300, 'x')));
+		}
+		const auto segments = logSegments(filename);
+		CHECK(segments.size() == 1);
+		if (segments.size() == 1) {
+#ifdef HAVE_ZLIB
+			// Closed segments are gzipped when zlib is available
+			const auto & segment = segments.front();
+			CHECK(segment.length() > 3 && segment.compare(segment.length() - 3, 3, ".gz") == 0);
+			gzFile input = gzopen(segment.c_str(), "rb");
+			CHECK(input != nullptr && gzdirect(input) == 0);
+			if (input != nullptr) {
+				char text[256] = {};
+				const auto n = gzread(input, text, sizeof(text) - 1);
+				CHECK(n > 0 && strstr(text, "\tfirst segment\n") != nullptr);
+				gzclose(input);
+			}
+#else
+			CHECK(segments.front().find(".gz") == std::string::npos);
+#endif
+		}
+		for (const auto & segment : segments)
+			remove(segment.c_str());
+		remove(filename.c_str());
+	}
+	
+	struct Credentials {
+		std::string name;
+		FixedBytes<16> salt{};
+		FixedBytes<32> hash{};
+	};
+	
+	using CredentialSchema = TableSchema<Column<&Credentials::name>, Column<&Credentials::salt>, Column<&Credentials::hash>>;
+	
+	void checkBytesColumns() {
+		const std::string filename = "check.credentials";
+		removeFiles(filename);
+		TypedDatabase<CredentialSchema, ',', Index<&Credentials::name>> credentials(filename);
+		
+		Credentials josh{"josh"};
+		for (size_t i = 0; i < josh.salt.size(); i++)
+			josh.salt[i] = static_cast<uint8_t>(i);
+		for (size_t i = 0; i < josh.hash.size(); i++)
+			josh.hash[i] = static_cast<uint8_t>(255 - i);
+		CHECK(credentials.insert(josh));
+		CHECK(Table(filename).find([](const auto & row) { return row[1] == "AAECAwQFBgcICQoLDA0ODw=="; }).has_value());
+		credentials.reload();
+		auto found = credentials.find(where<&Credentials::name>("josh"));
+		CHECK(found && found->salt == josh.salt && found->hash == josh.hash);
+		
+		// Written by Security, as base64 of 16 and 32 bytes
+		CHECK(Table(filename).insert({"anna", "c2FsdHNhbHRzYWx0c2FsdA==", "aGFzaGhhc2hoYXNoaGFzaGhhc2hoYXNoaGFzaGhhc2g="}));
+		const std::string text = "saltsaltsaltsalt";
+		// Too short, a stray character, padding inside, and bits set under the padding
+		for (const char * salt : {"AAECAwQFBgcICQoLDA0O", "AAECAwQFBgcICQoLDA0OD!==", "AAECAwQF=gcICQoLDA0ODw==", "AAECAwQFBgcICQoLDA0ODx=="})
+			CHECK(Table(filename).insert({std::string("bad") + salt, salt, "aGFzaGhhc2hoYXNoaGFzaGhhc2hoYXNoaGFzaGhhc2g="}));
+		credentials.reload();
+		found = credentials.find(where<&Credentials::name>("anna"));
+		CHECK(found && std::equal(text.begin(), text.end(), found->salt.begin()));
+		CHECK(!credentials.find([](const Credentials & row) { return row.name.compare(0, 3, "bad") == 0; }));
+		removeFiles(filename);
+	}
+	
+	void checkLineEnds() {
+		const std::string filename = "check.lines";
+		removeFiles(filename);
+		// A '\r' mid-line, "\r\n", an escaped delimiter, an empty line and no final line end
+		FILE * file = fopen(filename.c_str(), "w");
+		fputs("a,b,c\rd,e,f\r\ng,h\\,i,j\n\nk,l,m", file);
+		fclose(file);
+		
+		const std::vector<std::string> expected = {"a|b|c", "d|e|f", "g|h,i|j", "k|l|m"};
+		std::vector<std::string> scanned{};
+		Table table(filename);
+		CHECK(table.scan([&](const Table::DatabaseRowView & row) {
+			scanned.push_back(std::string(row[0]) + '|' + std::string(row[1]) + '|' + std::string(row[2]));
+			return true;
+		}) == 0);
+		CHECK(scanned == expected);
+		
+		std::vector<std::string> ranged{};
+		for (const auto & row : table.scan())
+			ranged.push_back(std::string(row[0]) + '|' + std::string(row[1]) + '|' + std::string(row[2]));
+		CHECK(ranged == expected);
+		removeFiles(filename);
+	}
+}
+
+int main() {
+	checkPasswdMgr();
+	checkCachedDatabase();
+	checkWriteAheadLog();
+	checkWhitelist();
+	checkTypedDatabase();
+	checkBytesColumns();
+	checkLineEnds();
+	checkLogRotation();
+	
+	if (failures > 0) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	fprintf(stdout, "All checks passed\n");
+	return 0;
+}
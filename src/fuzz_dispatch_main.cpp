@@ -0,0 +1,113 @@
+#include <NetworkMessage.h>
+#include <MessageDispatcher.h>
+
+#include <cstdlib>
+#include <string>
+
+/*
+ * libFuzzer target for the read path: the input is fed to a dispatcher built like
+ * TCPServer's, as TCPServer::onRead would see it, once in a single read and once split into
+ * reads whose sizes follow from the first input byte. Malformed input may only surface as a
+ * socket_error, and both runs must handle the same messages in the same order.
+ */
+namespace {
+	struct Recorder {
+		std::optional<uint64_t> currentRequest{};
+		std::string trace{};
+		bool inBatch = false;
+		
+		template<typename T>
+		void onMessage(int, const std::shared_ptr<void>&, const T & msg) {
+			record(T::TYPE);
+			if constexpr (T::COMPRESSIBLE)
+				trace += msg.compressed ? 'c' : 'u';
+			const auto frame = msg.encode();
+			trace.append(reinterpret_cast<const char *>(frame->data()), frame->length());
+		}
+		
+		void onBatch(int fd, const std::shared_ptr<void>& data, const BatchMessage & msg);
+		void onUnknown(int, const std::shared_ptr<void>&, MessageType type) { record(type); }
+		
+		void record(MessageType type) {
+			trace += std::to_string(static_cast<int>(type));
+			if (currentRequest.has_value())
+				trace += '#' + std::to_string(*currentRequest);
+			trace += ':';
+		}
+	};
+	
+	constexpr auto dispatcher = MessageDispatcher<Recorder, void>()
+			.on<HelloMessage,              &Recorder::onMessage<HelloMessage>>()
+			.on<Generic1Message,           &Recorder::onMessage<Generic1Message>>()
+			.on<Generic2Message,           &Recorder::onMessage<Generic2Message>>()
+			.on<Generic3Message,           &Recorder::onMessage<Generic3Message>>()
+			.on<Generic4Message,           &Recorder::onMessage<Generic4Message>>()
+			.on<Generic5Message,           &Recorder::onMessage<Generic5Message>>()
+			.on<MenuMessage,               &Recorder::onMessage<MenuMessage>>()
+			.on<DisplayMessage,            &Recorder::onMessage<DisplayMessage>>()
+			.on<LoginSetUsername,          &Recorder::onMessage<LoginSetUsername>>()
+			.on<LoginSetUsernameResponse,  &Recorder::onMessage<LoginSetUsernameResponse>>()
+			.on<LoginSetPassword,          &Recorder::onMessage<LoginSetPassword>>()
+			.on<LoginSetPasswordResponse,  &Recorder::onMessage<LoginSetPasswordResponse>>()
+			.on<LoginAuthenticate,         &Recorder::onMessage<LoginAuthenticate>>()
+			.on<LoginAuthenticateResponse, &Recorder::onMessage<LoginAuthenticateResponse>>()
+			.on<StreamBegin,               &Recorder::onMessage<StreamBegin>>()
+			.on<StreamChunk,               &Recorder::onMessage<StreamChunk>>()
+			.on<StreamEnd,                 &Recorder::onMessage<StreamEnd>>()
+			.on<BatchMessage,              &Recorder::onBatch>()
+			.requestIds<&Recorder::currentRequest>()
+			.otherwise<&Recorder::onUnknown>();
+	
+	void Recorder::onBatch(int fd, const std::shared_ptr<void>& data, const BatchMessage & msg) {
+		if (inBatch)
+			throw socket_error("received a batch nested inside another batch");
+		record(BatchMessage::TYPE);
+		inBatch = true;
+		try {
+			msg.forEach([&](MessageType type, const BufferByte * payload, size_t length) {
+				dispatcher.dispatchFrame(*this, fd, data, type, payload, length);
+			});
+		} catch (...) {
+			inBatch = false;
+			throw;
+		}
+		inBatch = false;
+	}
+	
+	/// Feeds `length` bytes in reads of at most `maxRead` bytes, with sizes drawn from `seed`, or
+	/// in one read if `maxRead` is 0
+	std::string replay(const BufferByte * input, size_t length, size_t maxRead, uint64_t seed, bool extendedFraming) {
+		Recorder recorder{};
+		DynamicBuffer buffer{};
+		try {
+			for (size_t offset = 0; offset < length; ) {
+				seed = seed * 6364136223846793005u + 1442695040888963407u;
+				auto read = length - offset;
+				if (maxRead > 0)
+					read = std::min(read, 1 + static_cast<size_t>(seed >> 33u) % maxRead);
+				buffer.addBuffer(std::make_shared<Buffer>(input + offset, read));
+				dispatcher.dispatch(recorder, -1, nullptr, buffer, extendedFraming);
+				offset += read;
+			}
+		} catch (const socket_error &) {
+			recorder.trace += '!';
+		}
+		return recorder.trace;
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size) {
+	if (size == 0)
+		return 0;
+	// Low bits choose how finely to split, so single-byte reads are tried as often as large ones
+	const auto control = data[0];
+	const auto extendedFraming = (control & 0x80u) != 0;
+	const size_t maxRead = size_t(1) << (control & 0x0Fu);
+	const auto input = reinterpret_cast<const BufferByte *>(data + 1);
+	
+	const auto whole = replay(input, size - 1, 0, 0, extendedFraming);
+	const auto split = replay(input, size - 1, maxRead, control, extendedFraming);
+	if (whole != split)
+		abort();
+	return 0;
+}
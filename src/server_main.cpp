@@ -15,9 +15,10 @@
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " [-p <portnum>] [-a <ip_addr>]\n";
+   std::cout << execname << " [-p <portnum>] [-a <ip_addr>] [-m <bytes>]\n";
    std::cout << "   p: the port to bind the server to\n";
    std::cout << "   a: the IP address to bind the server\n";
+   std::cout << "   m: the cap, in bytes, on memory held by connection buffers (0 for unlimited)\n";
 
 }
 
@@ -30,11 +31,12 @@ int main(int argc, char *argv[]) {
 
    unsigned short port = default_port;
    std::string ip_addr(default_IP);
+   size_t memory_limit = TCPServer::DEFAULT_MEMORY_LIMIT;
 
    // Get the command line arguments and set params appropriately
    int c = 0;
    long portval;
-   while ((c = getopt(argc, argv, "p:a:smw")) != -1) {
+   while ((c = getopt(argc, argv, "p:a:sm:w")) != -1) {
       switch (c) {
   
       // Set the max number to count up to	    
@@ -53,6 +55,11 @@ int main(int argc, char *argv[]) {
          ip_addr = optarg; 
          break;
 
+      // Cap on connection buffer memory
+      case 'm':
+         memory_limit = strtoull(optarg, NULL, 10);
+         break;
+
       case '?':
 	      displayHelp(argv[0]);
 	      break;
@@ -67,6 +74,7 @@ int main(int argc, char *argv[]) {
 
    // Try to set up the server for listening
    TCPServer server;
+   server.setMemoryLimit(memory_limit);
    try {
       cout << "Binding server to " << ip_addr << " port " << port << endl;
       server.bindSvr(ip_addr.c_str(), port);